@@ -3,6 +3,7 @@
 
 // includes
 
+#include "bitboard.h"
 #include "board.h"
 #include "colour.h"
 #include "move.h"
@@ -142,11 +143,36 @@ bool is_attacked(const board_t * board, int to, int colour) {
 
    const uint8 * ptr;
    int from, piece;
+   int sq_64, side;
+   uint64 occupied, attacker;
 
    ASSERT(board_is_ok(board));
    ASSERT(square_is_ok(to));
    ASSERT(colour_is_ok(colour));
 
+   if (UseBitboard) {
+
+      // look from the target square back at the attacker types
+
+      sq_64 = square_to_64(to);
+      side = (colour == White) ? 1 : 0; // HACK: WhiteX12 = BlackX12 + 1
+
+      attacker = PawnAttack[colour_opp(colour)][sq_64] & board->piece_bb[BlackPawn12+side];
+      attacker |= KnightAttack[sq_64] & board->piece_bb[BlackKnight12+side];
+      attacker |= KingAttack[sq_64] & board->piece_bb[BlackKing12+side];
+      if (attacker != 0) return true;
+
+      occupied = board->colour_bb[White] | board->colour_bb[Black];
+
+      attacker = board->piece_bb[BlackBishop12+side] | board->piece_bb[BlackQueen12+side];
+      if (attacker != 0 && (bishop_attack(sq_64,occupied) & attacker) != 0) return true;
+
+      attacker = board->piece_bb[BlackRook12+side] | board->piece_bb[BlackQueen12+side];
+      if (attacker != 0 && (rook_attack(sq_64,occupied) & attacker) != 0) return true;
+
+      return false;
+   }
+
    for (ptr = board->list[colour]; (from=*ptr) != SquareNone; ptr++) {
 
       piece = board->square[from];
@@ -0,0 +1,220 @@
+
+// bitboard.cpp
+
+// includes
+
+#include "bitboard.h"
+#include "board.h"
+#include "colour.h"
+#include "piece.h"
+#include "square.h"
+#include "util.h"
+
+// constants
+
+static const int DirN  = 0; // increasing square index
+static const int DirE  = 1;
+static const int DirNE = 2;
+static const int DirNW = 3;
+static const int DirS  = 4; // decreasing square index
+static const int DirW  = 5;
+static const int DirSW = 6;
+static const int DirSE = 7;
+static const int DirNb = 8;
+
+static const int DirFile[DirNb] = { 0, +1, +1, -1,  0, -1, -1, +1 };
+static const int DirRank[DirNb] = { +1, 0, +1, +1, -1,  0, -1, -1 };
+
+static const int KnightFile[8] = { -2, -2, -1, -1, +1, +1, +2, +2 };
+static const int KnightRank[8] = { -1, +1, -2, +2, -2, +2, -1, +1 };
+
+// "constants"
+
+uint64 SquareBit[SquareNb];
+
+uint64 PawnAttack[ColourNb][64];
+uint64 KnightAttack[64];
+uint64 KingAttack[64];
+
+// variables
+
+static uint64 Ray[DirNb][64];
+
+// prototypes
+
+static uint64 bit_make   (int file, int rank);
+static int    bit_last   (uint64 b);
+static uint64 ray_attack (int dir, int sq_64, uint64 occupied);
+
+// functions
+
+// bitboard_init()
+
+void bitboard_init() {
+
+   int sq, sq_64;
+   int file, rank;
+   int dir, i;
+   int f, r;
+
+   // squares
+
+   for (sq = 0; sq < SquareNb; sq++) {
+      SquareBit[sq] = square_is_ok(sq) ? uint64(1) << square_to_64(sq) : 0;
+   }
+
+   // attacks
+
+   for (sq_64 = 0; sq_64 < 64; sq_64++) {
+
+      file = sq_64 & 7;
+      rank = sq_64 >> 3;
+
+      PawnAttack[White][sq_64] = bit_make(file-1,rank+1) | bit_make(file+1,rank+1);
+      PawnAttack[Black][sq_64] = bit_make(file-1,rank-1) | bit_make(file+1,rank-1);
+
+      KnightAttack[sq_64] = 0;
+
+      for (i = 0; i < 8; i++) {
+         KnightAttack[sq_64] |= bit_make(file+KnightFile[i],rank+KnightRank[i]);
+      }
+
+      KingAttack[sq_64] = 0;
+
+      for (dir = 0; dir < DirNb; dir++) {
+
+         KingAttack[sq_64] |= bit_make(file+DirFile[dir],rank+DirRank[dir]);
+
+         Ray[dir][sq_64] = 0;
+
+         f = file + DirFile[dir];
+         r = rank + DirRank[dir];
+
+         while (f >= 0 && f < 8 && r >= 0 && r < 8) {
+            Ray[dir][sq_64] |= bit_make(f,r);
+            f += DirFile[dir];
+            r += DirRank[dir];
+         }
+      }
+   }
+}
+
+// bit_make()
+
+static uint64 bit_make(int file, int rank) {
+
+   if (file < 0 || file >= 8 || rank < 0 || rank >= 8) return 0;
+
+   return uint64(1) << ((rank << 3) | file);
+}
+
+// bit_first()
+
+int bit_first(uint64 b) {
+
+   ASSERT(b!=0);
+
+#ifdef __GNUC__
+   return __builtin_ctzll(b);
+#else
+   int sq_64;
+   for (sq_64 = 0; (b & 1) == 0; sq_64++) b >>= 1;
+   return sq_64;
+#endif
+}
+
+// bit_last()
+
+static int bit_last(uint64 b) {
+
+   ASSERT(b!=0);
+
+#ifdef __GNUC__
+   return 63 - __builtin_clzll(b);
+#else
+   int sq_64;
+   for (sq_64 = 63; (b >> 63) == 0; sq_64--) b <<= 1;
+   return sq_64;
+#endif
+}
+
+// ray_attack()
+
+static uint64 ray_attack(int dir, int sq_64, uint64 occupied) {
+
+   uint64 attack, blocker;
+
+   ASSERT(dir>=0&&dir<DirNb);
+   ASSERT(sq_64>=0&&sq_64<64);
+
+   // the ray stops at the first blocker, which is included
+
+   attack = Ray[dir][sq_64];
+   blocker = attack & occupied;
+
+   if (blocker != 0) {
+      attack ^= Ray[dir][(dir < DirS) ? bit_first(blocker) : bit_last(blocker)];
+   }
+
+   return attack;
+}
+
+// bishop_attack()
+
+uint64 bishop_attack(int sq_64, uint64 occupied) {
+
+   return ray_attack(DirNE,sq_64,occupied)
+        | ray_attack(DirNW,sq_64,occupied)
+        | ray_attack(DirSW,sq_64,occupied)
+        | ray_attack(DirSE,sq_64,occupied);
+}
+
+// rook_attack()
+
+uint64 rook_attack(int sq_64, uint64 occupied) {
+
+   return ray_attack(DirN,sq_64,occupied)
+        | ray_attack(DirE,sq_64,occupied)
+        | ray_attack(DirS,sq_64,occupied)
+        | ray_attack(DirW,sq_64,occupied);
+}
+
+// piece_attack_bb()
+
+uint64 piece_attack_bb(int piece, int sq_64, uint64 occupied) {
+
+   ASSERT(piece_is_ok(piece));
+   ASSERT(sq_64>=0&&sq_64<64);
+
+   switch (piece_type(piece)) {
+   case WhitePawn64:
+      return PawnAttack[White][sq_64];
+   case BlackPawn64:
+      return PawnAttack[Black][sq_64];
+   case Knight64:
+      return KnightAttack[sq_64];
+   case Bishop64:
+      return bishop_attack(sq_64,occupied);
+   case Rook64:
+      return rook_attack(sq_64,occupied);
+   case Queen64:
+      return bishop_attack(sq_64,occupied) | rook_attack(sq_64,occupied);
+   case King64:
+      return KingAttack[sq_64];
+   }
+
+   ASSERT(false);
+
+   return 0;
+}
+
+// board_occupied()
+
+uint64 board_occupied(const board_t * board) {
+
+   ASSERT(board!=NULL);
+
+   return board->colour_bb[White] | board->colour_bb[Black];
+}
+
+// end of bitboard.cpp
@@ -0,0 +1,39 @@
+
+// bitboard.h
+
+#ifndef BITBOARD_H
+#define BITBOARD_H
+
+// includes
+
+#include "board.h"
+#include "util.h"
+
+// constants
+
+const bool UseBitboard = true; // mailbox code is kept as the reference
+
+// "constants"
+
+extern uint64 SquareBit[SquareNb];
+
+extern uint64 PawnAttack[ColourNb][64];
+extern uint64 KnightAttack[64];
+extern uint64 KingAttack[64];
+
+// functions
+
+extern void   bitboard_init   ();
+
+extern int    bit_first       (uint64 b);
+
+extern uint64 bishop_attack   (int sq_64, uint64 occupied);
+extern uint64 rook_attack     (int sq_64, uint64 occupied);
+
+extern uint64 piece_attack_bb (int piece, int sq_64, uint64 occupied);
+
+extern uint64 board_occupied  (const board_t * board);
+
+#endif // !defined BITBOARD_H
+
+// end of bitboard.h
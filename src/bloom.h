@@ -0,0 +1,146 @@
+
+// bloom.h
+
+#ifndef BLOOM_H
+#define BLOOM_H
+
+// includes
+
+#include <cstdio>
+#include <cstring>
+
+#include "table.h"
+#include "util.h"
+
+// constants
+
+const int BloomBitsPerKey = 16;
+const int BloomBlockSize = 64; // bytes, one cache line
+const int BloomWordNb = BloomBlockSize / 8;
+
+// types
+
+// blocked Bloom filter over (key, move) pairs, checked before a large
+// table: each pair sets one bit in each 64-bit word of a single block,
+// so that a miss costs one cache line instead of a probe sequence
+
+struct bloom_t {
+   uint32 block_nb;
+   uint64 * block; // block_nb * BloomWordNb words, cache-line aligned
+   void * alloc;
+};
+
+// functions
+
+// bloom_hash()
+
+inline uint64 bloom_hash(uint64 key, int move) {
+
+   // the key is already random, only the move needs mixing in
+
+   return (key ^ (uint64(move) * U64(0x9E3779B97F4A7C15))) * U64(0xC2B2AE3D27D4EB4F);
+}
+
+// bloom_mask()
+
+inline uint64 bloom_mask(uint32 hash, int word) {
+
+   static const uint32 Salt[BloomWordNb] = {
+      0x47B6137B, 0x44974D91, 0x8824AD5B, 0xA2B7289D,
+      0x705495C7, 0x2DF1424B, 0x9EFC4947, 0x5C6BFB31,
+   };
+
+   return U64(1) << ((hash * Salt[word]) >> 26);
+}
+
+// bloom_word()
+
+inline uint64 * bloom_word(const bloom_t * bloom, uint64 hash) {
+
+   uint32 index;
+
+   // high bits pick the block, scaled to the block count without a division
+
+   index = uint32((uint64(uint32(hash >> 32)) * bloom->block_nb) >> 32);
+
+   return &bloom->block[uint64(index)*BloomWordNb];
+}
+
+// bloom_init()
+
+inline void bloom_init(bloom_t * bloom, int size) {
+
+   size_t bytes;
+
+   ASSERT(bloom!=NULL);
+   ASSERT(size>=0);
+
+   bloom->block_nb = uint32((uint64(size) * BloomBitsPerKey) / (BloomBlockSize * 8) + 1);
+
+   bytes = size_t(bloom->block_nb) * BloomBlockSize;
+
+   if (bytes >= 1048576) fprintf(stderr,"allocating %gMB ...\n",double(bytes)/1048576.0);
+
+   bloom->alloc = my_malloc(bytes+BloomBlockSize);
+   bloom->block = (uint64 *) ((size_t(bloom->alloc) + BloomBlockSize - 1) & ~size_t(BloomBlockSize - 1));
+
+   table_advise(bloom->block,bytes);
+   memset(bloom->block,0,bytes);
+}
+
+// bloom_free()
+
+inline void bloom_free(bloom_t * bloom) {
+
+   ASSERT(bloom!=NULL);
+
+   if (bloom->alloc != NULL) my_free(bloom->alloc);
+
+   bloom->alloc = NULL;
+   bloom->block = NULL;
+}
+
+// bloom_add()
+
+inline void bloom_add(bloom_t * bloom, uint64 key, int move) {
+
+   uint64 hash;
+   uint64 * word;
+   int i;
+
+   ASSERT(bloom!=NULL);
+   ASSERT(bloom->block!=NULL);
+
+   hash = bloom_hash(key,move);
+   word = bloom_word(bloom,hash);
+
+   for (i = 0; i < BloomWordNb; i++) word[i] |= bloom_mask(uint32(hash),i);
+}
+
+// bloom_has()
+
+inline bool bloom_has(const bloom_t * bloom, uint64 key, int move) {
+
+   uint64 hash;
+   const uint64 * word;
+   int i;
+
+   ASSERT(bloom!=NULL);
+   ASSERT(bloom->block!=NULL);
+
+   // false positives only, never false negatives
+
+   hash = bloom_hash(key,move);
+   word = bloom_word(bloom,hash);
+
+   for (i = 0; i < BloomWordNb; i++) {
+      if ((word[i] & bloom_mask(uint32(hash),i)) == 0) return false;
+   }
+
+   return true;
+}
+
+#endif // !defined BLOOM_H
+
+// end of bloom.h
+
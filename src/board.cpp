@@ -6,6 +6,7 @@
 #include <cstdio>
 
 #include "attack.h"
+#include "bitboard.h"
 #include "board.h"
 #include "colour.h"
 #include "fen.h"
@@ -28,9 +29,10 @@ static const bool UseSlowDebug = false;
 
 bool board_is_ok(const board_t * board) {
 
-   int sq, piece;
+   int sq, piece, piece_12;
    int colour, pos;
    int king, rook;
+   uint64 bit;
 
    if (board == NULL) return false;
 
@@ -55,6 +57,20 @@ bool board_is_ok(const board_t * board) {
       }
    }
 
+   // bitboards
+
+   for (sq = 0; sq < SquareNb; sq++) {
+      if (square_is_ok(sq)) {
+         piece = board->square[sq];
+         bit = SquareBit[sq];
+         for (piece_12 = 0; piece_12 < 12; piece_12++) {
+            if (((board->piece_bb[piece_12] & bit) != 0) != (piece != Empty && piece_to_12(piece) == piece_12)) return false;
+         }
+         if (((board->colour_bb[White] & bit) != 0) != (piece != Empty && colour_equal(piece,White))) return false;
+         if (((board->colour_bb[Black] & bit) != 0) != (piece != Empty && colour_equal(piece,Black))) return false;
+      }
+   }
+
    // white piece list
 
    colour = White;
@@ -204,6 +220,11 @@ void board_clear(board_t * board) {
 
    for (piece = 0; piece < 12; piece++) {
       board->number[piece] = 0;
+      board->piece_bb[piece] = 0;
+   }
+
+   for (colour = 0; colour < ColourNb; colour++) {
+      board->colour_bb[colour] = 0;
    }
 
    // rest
@@ -288,6 +309,20 @@ void board_init_list(board_t * board) {
 
    for (piece = 0; piece < 12; piece++) board->number[piece] = 0;
 
+   // bitboards
+
+   for (piece = 0; piece < 12; piece++) board->piece_bb[piece] = 0;
+   for (colour = 0; colour < ColourNb; colour++) board->colour_bb[colour] = 0;
+
+   for (sq_64 = 0; sq_64 < 64; sq_64++) {
+      sq = square_from_64(sq_64);
+      piece = board->square[sq];
+      if (piece != Empty) {
+         board->piece_bb[piece_to_12(piece)] |= SquareBit[sq];
+         board->colour_bb[piece_colour(piece)] |= SquareBit[sq];
+      }
+   }
+
    // white piece list
 
    colour = White;
@@ -381,6 +416,7 @@ int board_flags(const board_t * board) {
 
 bool board_can_play(const board_t * board) {
 
+   board_t new_board[1];
    list_t list[1];
    int i, move;
 
@@ -388,9 +424,11 @@ bool board_can_play(const board_t * board) {
 
    gen_moves(list,board);
 
+   board_copy(new_board,board);
+
    for (i = 0; i < list_size(list); i++) {
       move = list_move(list,i);
-      if (pseudo_is_legal(move,board)) return true;
+      if (pseudo_is_legal_do(move,new_board)) return true;
    }
 
    return false; // no legal move
@@ -30,6 +30,9 @@ struct board_t {
 
    sint8 number[12];
 
+   uint64 piece_bb[12];
+   uint64 colour_bb[ColourNb];
+
    sint8 turn;
    uint8 castle[ColourNb][SideNb];
    uint8 ep_square;
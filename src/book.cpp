@@ -8,6 +8,11 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
 #include "board.h"
 #include "book.h"
 #include "move.h"
@@ -15,6 +20,13 @@
 #include "san.h"
 #include "util.h"
 
+// constants
+
+static const bool UseMmap = true;
+static const bool UseIndex = true;
+
+static const int IndexStep = 8; // entries per index key, two cache lines
+
 // types
 
 struct entry_t {
@@ -30,14 +42,26 @@ struct entry_t {
 static FILE * BookFile;
 static int BookSize;
 
+static const uint8 * BookData; // the whole file, big-endian entries
+static bool BookMapped;
+
+static int IndexSize;
+static uint64 * IndexKey; // every IndexStep-th key in Eytzinger order, from 1
+static int * IndexRank; // sorted rank of each index key
+
 // prototypes
 
+static void   index_build   ();
+static void   index_fill    (int k, int * rank);
+
 static int    find_pos      (uint64 key);
+static uint64 read_key      (int n);
 
 static void   read_entry    (entry_t * entry, int n);
 static void   write_entry   (const entry_t * entry, int n);
 
-static uint64 read_integer  (FILE * file, int size);
+static uint64 read_integer  (const uint8 * data, int size);
+static void   store_integer (uint8 * data, int size, uint64 n);
 static void   write_integer (FILE * file, int size, uint64 n);
 
 // functions
@@ -48,12 +72,23 @@ void book_clear() {
 
    BookFile = NULL;
    BookSize = 0;
+
+   BookData = NULL;
+   BookMapped = false;
+
+   IndexSize = 0;
+   IndexKey = NULL;
+   IndexRank = NULL;
 }
 
 // book_open()
 
 void book_open(const char file_name[]) {
 
+   sint64 size;
+   void * address;
+   uint8 * data;
+
    ASSERT(file_name!=NULL);
 
    BookFile = fopen(file_name,"rb+");
@@ -63,14 +98,66 @@ void book_open(const char file_name[]) {
       my_fatal("book_open(): fseek(): %s\n",strerror(errno));
    }
 
-   BookSize = ftell(BookFile) / 16;
+   size = ftell(BookFile);
+
+   BookSize = size / 16;
    if (BookSize == 0) my_fatal("book_open(): empty file\n");
+
+   // probes read memory, learning still writes through BookFile
+
+   BookData = NULL;
+   BookMapped = false;
+
+   if (UseMmap) {
+
+      address = mmap(NULL,size,PROT_READ,MAP_SHARED,fileno(BookFile),0);
+
+      if (address != MAP_FAILED) {
+         BookData = (const uint8 *) address;
+         BookMapped = true;
+      }
+   }
+
+   if (!BookMapped) {
+
+      data = (uint8 *) my_malloc(BookSize*16);
+
+      if (fseek(BookFile,0,SEEK_SET) == -1) {
+         my_fatal("book_open(): fseek(): %s\n",strerror(errno));
+      }
+
+      if (fread(data,16,BookSize,BookFile) != size_t(BookSize)) {
+         my_fatal("book_open(): fread(): %s\n",strerror(errno));
+      }
+
+      BookData = data;
+   }
+
+   if (UseIndex) index_build();
 }
 
 // book_close()
 
 void book_close() {
 
+   if (IndexKey != NULL) {
+      my_free(IndexKey);
+      my_free(IndexRank);
+   }
+
+   IndexSize = 0;
+   IndexKey = NULL;
+   IndexRank = NULL;
+
+   if (BookMapped) {
+      munmap((void *)BookData,sint64(BookSize)*16);
+   } else {
+      my_free((void *)BookData);
+   }
+
+   BookData = NULL;
+   BookMapped = false;
+
    if (fclose(BookFile) == EOF) {
       my_fatal("book_close(): fclose(): %s\n",strerror(errno));
    }
@@ -229,13 +316,87 @@ void book_flush() {
    }
 }
 
+// index_build()
+
+static void index_build() {
+
+   int rank;
+
+   // a binary search over the whole file misses the cache at every step,
+   // the Eytzinger layout keeps the first levels packed together
+
+   IndexSize = (BookSize + IndexStep - 1) / IndexStep;
+
+   IndexKey = (uint64 *) my_malloc((IndexSize+1)*sizeof(uint64));
+   IndexRank = (int *) my_malloc((IndexSize+1)*sizeof(int));
+
+   IndexKey[0] = 0; // unused
+   IndexRank[0] = -1;
+
+   rank = 0;
+   index_fill(1,&rank);
+   ASSERT(rank==IndexSize);
+}
+
+// index_fill()
+
+static void index_fill(int k, int * rank) {
+
+   ASSERT(k>=1);
+   ASSERT(rank!=NULL);
+
+   // in-order walk of the implicit tree, children of k are 2k and 2k+1
+
+   if (k > IndexSize) return;
+
+   index_fill(2*k,rank);
+
+   IndexKey[k] = read_key(*rank*IndexStep);
+   IndexRank[k] = *rank;
+   (*rank)++;
+
+   index_fill(2*k+1,rank);
+}
+
 // find_pos()
 
 static int find_pos(uint64 key) {
 
    int left, right, mid;
+   int k, rank, pos, end;
    entry_t entry[1];
 
+   if (IndexKey != NULL) {
+
+      // first index key >= key
+
+      for (k = 1; k <= IndexSize; k = 2 * k + (IndexKey[k] < key)) {
+#ifdef __GNUC__
+         __builtin_prefetch(&IndexKey[16*k]); // four levels ahead
+#endif
+      }
+
+      while ((k & 1) != 0) k >>= 1; // climb back over the right turns
+      k >>= 1;
+
+      rank = (k == 0) ? IndexSize : IndexRank[k];
+
+      // the leftmost entry lies after the previous index key
+
+      if (rank == 0) return (read_key(0) == key) ? 0 : BookSize;
+
+      pos = (rank - 1) * IndexStep + 1;
+
+      end = rank * IndexStep;
+      if (end > BookSize-1) end = BookSize-1;
+
+      for (; pos <= end; pos++) {
+         if (read_key(pos) >= key) break;
+      }
+
+      return (pos <= end && read_key(pos) == key) ? pos : BookSize;
+   }
+
    // binary search (finds the leftmost entry)
 
    left = 0;
@@ -268,28 +429,39 @@ static int find_pos(uint64 key) {
 
 static void read_entry(entry_t * entry, int n) {
 
+   const uint8 * data;
+
    ASSERT(entry!=NULL);
    ASSERT(n>=0&&n<BookSize);
 
-   if (fseek(BookFile,n*16,SEEK_SET) == -1) {
-      my_fatal("read_entry(): fseek(): %s\n",strerror(errno));
-   }
+   data = BookData + sint64(n) * 16;
+
+   entry->key   = read_integer(data+0,8);
+   entry->move  = read_integer(data+8,2);
+   entry->count = read_integer(data+10,2);
+   entry->n     = read_integer(data+12,2);
+   entry->sum   = read_integer(data+14,2);
+}
 
-   entry->key   = read_integer(BookFile,8);
-   entry->move  = read_integer(BookFile,2);
-   entry->count = read_integer(BookFile,2);
-   entry->n     = read_integer(BookFile,2);
-   entry->sum   = read_integer(BookFile,2);
+// read_key()
+
+static uint64 read_key(int n) {
+
+   ASSERT(n>=0&&n<BookSize);
+
+   return read_integer(BookData+sint64(n)*16,8);
 }
 
 // write_entry()
 
 static void write_entry(const entry_t * entry, int n) {
 
+   uint8 * data;
+
    ASSERT(entry!=NULL);
    ASSERT(n>=0&&n<BookSize);
 
-   if (fseek(BookFile,n*16,SEEK_SET) == -1) {
+   if (fseek(BookFile,sint64(n)*16,SEEK_SET) == -1) {
       my_fatal("write_entry(): fseek(): %s\n",strerror(errno));
    }
 
@@ -298,38 +470,60 @@ static void write_entry(const entry_t * entry, int n) {
    write_integer(BookFile,2,entry->count);
    write_integer(BookFile,2,entry->n);
    write_integer(BookFile,2,entry->sum);
+
+   // keep the in-memory view in step with the file
+
+   if (BookMapped) {
+
+      if (fflush(BookFile) == EOF) { // the shared mapping sees the page cache
+         my_fatal("write_entry(): fflush(): %s\n",strerror(errno));
+      }
+
+   } else {
+
+      data = (uint8 *) BookData + sint64(n) * 16;
+
+      store_integer(data+0,8,entry->key);
+      store_integer(data+8,2,entry->move);
+      store_integer(data+10,2,entry->count);
+      store_integer(data+12,2,entry->n);
+      store_integer(data+14,2,entry->sum);
+   }
 }
 
 // read_integer()
 
-static uint64 read_integer(FILE * file, int size) {
+static uint64 read_integer(const uint8 * data, int size) {
 
    uint64 n;
    int i;
-   int b;
 
-   ASSERT(file!=NULL);
+   ASSERT(data!=NULL);
    ASSERT(size>0&&size<=8);
 
    n = 0;
 
    for (i = 0; i < size; i++) {
+      n = (n << 8) | data[i];
+   }
+
+   return n;
+}
 
-      b = fgetc(file);
+// store_integer()
 
-      if (b == EOF) {
-         if (feof(file)) {
-            my_fatal("read_integer(): fgetc(): EOF reached\n");
-         } else { // error
-            my_fatal("read_integer(): fgetc(): %s\n",strerror(errno));
-         }
-      }
+static void store_integer(uint8 * data, int size, uint64 n) {
 
-      ASSERT(b>=0&&b<256);
-      n = (n << 8) | b;
-   }
+   int i;
 
-   return n;
+   ASSERT(data!=NULL);
+   ASSERT(size>0&&size<=8);
+   ASSERT(size==8||n>>(size*8)==0);
+
+   for (i = size-1; i >= 0; i--) {
+      data[i] = n & 0xFF;
+      n >>= 8;
+   }
 }
 
 // write_integer()
@@ -9,37 +9,59 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <unistd.h>
+
 #include "board.h"
 #include "book_make.h"
+#include "ingest.h"
 #include "move.h"
 #include "move_do.h"
 #include "move_legal.h"
 #include "pgn.h"
 #include "san.h"
+#include "table.h"
+#include "thread.h"
 #include "util.h"
 
 // constants
 
-static const int COUNT_MAX = 16384;
-
 static const int NIL = -1;
 
+static const int PartBits = 4;
+static const int PartNb = 1 << PartBits;
+static const int PartLevelMax = 64 / PartBits;
+
+static const int WeightMax = 65535; // 16-bit book field
+
+static const int WriteSize = 65536; // entries per write block
+
+static const int DigitNb = 16; // radix sort: 8 score bytes, then 8 key bytes
+
 // types
 
 struct entry_t {
    uint64 key;
+   uint64 n;
+   uint64 sum;
    uint16 move;
-   uint16 n;
-   uint16 sum;
    uint16 colour;
 };
 
-struct book_t {
-   int size;
-   int alloc;
-   uint32 mask;
-   entry_t * entry;
-   sint32 * hash;
+typedef table_t<entry_t> book_t;
+
+struct record_t {
+   uint64 key;
+   uint16 move;
+   uint8 colour;
+   uint8 score; // result + 1
+};
+
+// a table entry plus its two hash slots and its copy in the sort buffer
+
+static const int EntryCost = 2 * sizeof(entry_t) + 2 * sizeof(uint64);
+
+struct part_t {
+   FILE * entry; // table contents at each flush, in creation order
 };
 
 // variables
@@ -50,27 +72,58 @@ static double MinScore;
 static bool RemoveWhite, RemoveBlack;
 static bool Uniform;
 
+static sint64 MemLimit;
+static const char * TmpDir;
+static sint64 ExpectedPositions;
+static int Threads;
+
 static book_t Book[1];
+static int BookAllocMax; // 0 = no limit
+
+static int ShardNb; // 1 = Book only
+static book_t Shard[ThreadMax]; // key ranges in increasing order
+
+static bool Spilled;
+static part_t Part[PartNb];
 
 // prototypes
 
-static void   book_clear    ();
 static void   book_insert   (const char file_name[]);
-static void   book_filter   ();
-static void   book_sort     ();
+static void   book_filter   (book_t * book);
+static void   book_sort     (book_t * book);
 static void   book_save     (const char file_name[]);
+static void   book_write    (FILE * file, const book_t * book);
 
-static int    find_entry    (const board_t * board, int move);
-static void   resize        ();
-static void   halve_stats   (uint64 key);
+static void   shard_insert  (const char file_name[]);
+static void   shard_save    (const char file_name[]);
+static void   shard_thread  (int id, void * data);
+static int    shard_index   (uint64 key);
 
-static bool   keep_entry    (int pos);
+static void   game_records  (pgn_t * pgn, record_list_t list[]);
+static void   record_add    (record_list_t * list, const board_t * board, int move, int result);
+static void   list_apply    (int shard, record_list_t * list);
 
-static int    entry_score    (const entry_t * entry);
+static void   spill_flush   ();
+static void   spill_save    (const char file_name[]);
+static void   part_save     (FILE * file, part_t * part, int level);
+static void   part_split    (FILE * file, part_t * part, int level);
+static int    part_index    (uint64 key, int level);
+static FILE * temp_open     ();
 
+static int    find_entry    (book_t * book, uint64 key, int move, int colour);
+
+static bool   keep_entry    (const entry_t * entry);
+
+static uint64 entry_score    (const entry_t * entry);
+
+#if DEBUG
 static int    key_compare   (const void * p1, const void * p2);
+#endif
+static void   entry_sort    (entry_t * entry, entry_t * tmp, int size);
+static int    entry_digit   (const entry_t * entry, int digit);
 
-static void   write_integer (FILE * file, int size, uint64 n);
+static void   write_block   (FILE * file, const uint8 * data, int size);
+static void   write_integer (uint8 * data, int size, uint64 n);
 
 // functions
 
@@ -81,6 +134,7 @@ void book_make(int argc, char * argv[]) {
    int i;
    const char * pgn_file;
    const char * bin_file;
+   int hint;
 
    pgn_file = NULL;
    my_string_set(&pgn_file,"book.pgn");
@@ -95,6 +149,11 @@ void book_make(int argc, char * argv[]) {
    RemoveBlack = false;
    Uniform = false;
 
+   MemLimit = 0;
+   TmpDir = NULL;
+   ExpectedPositions = 0;
+   Threads = 1;
+
    for (i = 1; i < argc; i++) {
 
       if (false) {
@@ -155,45 +214,116 @@ void book_make(int argc, char * argv[]) {
 
          Uniform = true;
 
+      } else if (my_string_equal(argv[i],"-mem-limit")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
+
+         MemLimit = my_atoll(argv[i]);
+
+         switch (argv[i][strlen(argv[i])-1]) {
+         case 'k': case 'K': MemLimit <<= 10; break;
+         case 'm': case 'M': MemLimit <<= 20; break;
+         case 'g': case 'G': MemLimit <<= 30; break;
+         }
+
+         if (MemLimit < sint64(256 * EntryCost)) my_fatal("book_make(): memory limit too small\n");
+
+      } else if (my_string_equal(argv[i],"-expected-positions")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
+
+         ExpectedPositions = my_atoll(argv[i]);
+         if (ExpectedPositions < 0) my_fatal("book_make(): invalid number of positions\n");
+
+      } else if (my_string_equal(argv[i],"-tmp-dir")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
+
+         my_string_set(&TmpDir,argv[i]);
+
+      } else if (my_string_equal(argv[i],"-threads")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
+
+         Threads = atoi(argv[i]);
+         if (Threads <= 0) Threads = thread_nb_default();
+         if (Threads > ThreadMax) Threads = ThreadMax;
+
       } else {
 
          my_fatal("book_make(): unknown option \"%s\"\n",argv[i]);
       }
    }
 
-   book_clear();
+   BookAllocMax = 0;
 
-   printf("inserting games ...\n");
-   book_insert(pgn_file);
+   if (MemLimit != 0) {
+      for (BookAllocMax = 256; sint64(BookAllocMax) * 2 * EntryCost <= MemLimit && BookAllocMax < TableAllocMax; BookAllocMax *= 2)
+         ;
+   }
 
-   printf("filtering entries ...\n");
-   book_filter();
+   // size the table for the whole input
 
-   printf("sorting entries ...\n");
-   book_sort();
+   if (ExpectedPositions != 0) {
+      hint = (ExpectedPositions > TableAllocMax) ? TableAllocMax : int(ExpectedPositions);
+   } else {
+      hint = table_estimate(my_file_size(pgn_file),MaxPly);
+   }
 
-   printf("saving entries ...\n");
-   book_save(bin_file);
+   if (BookAllocMax != 0 && hint > BookAllocMax) hint = BookAllocMax;
 
-   printf("all done!\n");
-}
+   Spilled = false;
+
+   // one table per key range with several threads, spilling needs the single table
 
-// book_clear()
+   ShardNb = (Threads > 1 && BookAllocMax == 0) ? Threads : 1;
 
-static void book_clear() {
+   if (ShardNb > 1) {
 
-   int index;
+      for (i = 0; i < ShardNb; i++) {
+         table_init(&Shard[i],hint/ShardNb+1);
+      }
 
-   Book->alloc = 1;
-   Book->mask = (Book->alloc * 2) - 1;
+      printf("inserting games ...\n");
+      shard_insert(pgn_file);
 
-   Book->entry = (entry_t *) my_malloc(Book->alloc*sizeof(entry_t));
-   Book->size = 0;
+      printf("filtering and sorting entries ...\n");
+      shard_save(bin_file);
 
-   Book->hash = (sint32 *) my_malloc((Book->alloc*2)*sizeof(sint32));
-   for (index = 0; index < Book->alloc*2; index++) {
-      Book->hash[index] = NIL;
+      printf("all done!\n");
+      return;
    }
+
+   table_init(Book,hint);
+
+   printf("inserting games ...\n");
+   book_insert(pgn_file);
+
+   if (Spilled) {
+
+      printf("filtering, sorting and saving partitions ...\n");
+      spill_save(bin_file);
+
+   } else {
+
+      printf("filtering entries ...\n");
+      book_filter(Book);
+      printf("%d entries.\n",Book->size);
+
+      printf("sorting entries ...\n");
+      book_sort(Book);
+
+      printf("saving entries ...\n");
+      book_save(bin_file);
+   }
+
+   table_free(Book);
+
+   printf("all done!\n");
 }
 
 // book_insert()
@@ -238,20 +368,26 @@ static void book_insert(const char file_name[]) {
 
             move = move_from_san(string,board);
 
-            if (move == MoveNone || !move_is_legal(move,board)) {
+            if (move == MoveNone) { // move_from_san() only returns legal moves
                printf("book_insert(): illegal move \"%s\" at line %d, column %d\n",string,pgn->move_line,pgn->move_column);
                continue;
             }
 
-            pos = find_entry(board,move);
+            pos = find_entry(Book,board->key,move,board->turn);
 
-            Book->entry[pos].n++;
-            Book->entry[pos].sum += result+1;
+            if (pos == NIL) {
+
+               // table full, move its counts to disk and start over
 
-            if (Book->entry[pos].n >= COUNT_MAX) {
-               halve_stats(board->key);
+               spill_flush();
+
+               pos = find_entry(Book,board->key,move,board->turn);
+               ASSERT(pos!=NIL);
             }
 
+            Book->entry[pos].n++;
+            Book->entry[pos].sum += result+1;
+
             move_do(board,move);
             ply++;
             result = -result;
@@ -265,38 +401,225 @@ static void book_insert(const char file_name[]) {
    pgn_close(pgn);
 
    printf("%d game%s.\n",game_nb,(game_nb>1)?"s":"");
-   printf("%d entries.\n",Book->size);
+   if (!Spilled) printf("%d entries.\n",Book->size);
 
    return;
 }
 
+// shard_insert()
+
+static void shard_insert(const char file_name[]) {
+
+   int game_nb;
+   pgn_t pgn[1];
+   int size;
+   int i;
+
+   ASSERT(file_name!=NULL);
+   ASSERT(ShardNb>1);
+
+   // scan loop
+
+   pgn_open(pgn,file_name);
+   game_nb = ingest_shards(pgn,Threads,ShardNb,sizeof(record_t),game_records,list_apply,stdout);
+   pgn_close(pgn);
+
+   size = 0;
+   for (i = 0; i < ShardNb; i++) size += Shard[i].size;
+
+   printf("%d game%s.\n",game_nb,(game_nb>1)?"s":"");
+   printf("%d entries.\n",size);
+}
+
+// shard_save()
+
+static void shard_save(const char file_name[]) {
+
+   FILE * file;
+   int size;
+   int i;
+
+   ASSERT(file_name!=NULL);
+   ASSERT(ShardNb>1);
+
+   thread_run(ShardNb,shard_thread,NULL);
+
+   size = 0;
+   for (i = 0; i < ShardNb; i++) size += Shard[i].size;
+
+   printf("%d entries.\n",size);
+
+   printf("saving entries ...\n");
+
+   file = fopen(file_name,"wb");
+   if (file == NULL) my_fatal("shard_save(): can't open file \"%s\" for writing: %s\n",file_name,strerror(errno));
+
+   // shards are key ranges in increasing order, so sorted shards
+   // concatenate into a sorted book
+
+   for (i = 0; i < ShardNb; i++) {
+      book_write(file,&Shard[i]);
+      table_free(&Shard[i]);
+   }
+
+   if (fclose(file) == EOF) {
+      my_fatal("shard_save(): fclose(): %s\n",strerror(errno));
+   }
+}
+
+// shard_thread()
+
+static void shard_thread(int id, void *) {
+
+   ASSERT(id>=0&&id<ShardNb);
+
+   book_filter(&Shard[id]);
+   book_sort(&Shard[id]);
+}
+
+// shard_index()
+
+static int shard_index(uint64 key) {
+
+   // monotonic in the key, the low bits index the hash table
+
+   return int(((key >> 32) * uint64(ShardNb)) >> 32);
+}
+
+// game_records()
+
+static void game_records(pgn_t * pgn, record_list_t list[]) {
+
+   board_t board[1];
+   int ply;
+   int result;
+   char string[256];
+   int move;
+
+   ASSERT(pgn!=NULL);
+   ASSERT(list!=NULL);
+
+   board_start(board);
+   ply = 0;
+   result = 0;
+
+   if (false) {
+   } else if (my_string_equal(pgn->result,"1-0")) {
+      result = +1;
+   } else if (my_string_equal(pgn->result,"0-1")) {
+      result = -1;
+   }
+
+   while (pgn_next_move(pgn,string,256)) {
+
+      if (ply < MaxPly) {
+
+         move = move_from_san(string,board);
+
+         if (move == MoveNone) { // move_from_san() only returns legal moves
+            printf("book_insert(): illegal move \"%s\" at line %d, column %d\n",string,pgn->move_line,pgn->move_column);
+            continue;
+         }
+
+         record_add(&list[shard_index(board->key)],board,move,result);
+
+         move_do(board,move);
+         ply++;
+         result = -result;
+      }
+   }
+}
+
+// record_add()
+
+static void record_add(record_list_t * list, const board_t * board, int move, int result) {
+
+   record_t * record;
+
+   ASSERT(list!=NULL);
+   ASSERT(board!=NULL);
+   ASSERT(move_is_ok(move));
+   ASSERT(result>=-1&&result<=+1);
+
+   record = (record_t *) record_new(list);
+
+   record->key = board->key;
+   record->move = move;
+   record->colour = board->turn;
+   record->score = result+1;
+}
+
+// list_apply()
+
+static void list_apply(int shard, record_list_t * list) {
+
+   book_t * book;
+   const record_t * record;
+   int i;
+   int pos;
+
+   ASSERT(shard>=0&&shard<ShardNb);
+   ASSERT(list!=NULL);
+
+   book = &Shard[shard];
+
+   for (i = 0; i < list->size; i++) {
+
+      record = &((const record_t *) list->record)[i];
+
+      pos = find_entry(book,record->key,record->move,record->colour);
+      ASSERT(pos!=NIL);
+
+      book->entry[pos].n++;
+      book->entry[pos].sum += record->score;
+   }
+}
+
 // book_filter()
 
-static void book_filter() {
+static void book_filter(book_t * book) {
 
    int src, dst;
 
+   ASSERT(book!=NULL);
+
    // entry loop
 
    dst = 0;
 
-   for (src = 0; src < Book->size; src++) {
-      if (keep_entry(src)) Book->entry[dst++] = Book->entry[src];
+   for (src = 0; src < book->size; src++) {
+      if (keep_entry(&book->entry[src])) book->entry[dst++] = book->entry[src];
    }
 
-   ASSERT(dst>=0&&dst<=Book->size);
-   Book->size = dst;
-
-   printf("%d entries.\n",Book->size);
+   ASSERT(dst>=0&&dst<=book->size);
+   book->size = dst;
 }
 
 // book_sort()
 
-static void book_sort() {
+static void book_sort(book_t * book) {
+
+   entry_t * tmp;
+#if DEBUG
+   int pos;
+#endif
 
-   // sort keys for binary search
+   ASSERT(book!=NULL);
 
-   qsort(Book->entry,Book->size,sizeof(entry_t),&key_compare);
+   if (book->size == 0) return; // empty shard or partition
+
+   // sort keys for binary search, stable so that spilled partitions
+   // and shards come out in the same order as the whole table would
+
+   tmp = (entry_t *) my_malloc(book->size*sizeof(entry_t));
+   entry_sort(book->entry,tmp,book->size);
+   my_free(tmp);
+
+#if DEBUG
+   for (pos = 1; pos < book->size; pos++) {
+      ASSERT(key_compare(&book->entry[pos-1],&book->entry[pos])<=0);
+   }
+#endif
 }
 
 // book_save()
@@ -304,167 +627,321 @@ static void book_sort() {
 static void book_save(const char file_name[]) {
 
    FILE * file;
-   int pos;
 
    ASSERT(file_name!=NULL);
 
    file = fopen(file_name,"wb");
    if (file == NULL) my_fatal("book_save(): can't open file \"%s\" for writing: %s\n",file_name,strerror(errno));
 
+   book_write(file,Book);
+
+   if (fclose(file) == EOF) {
+      my_fatal("book_save(): fclose(): %s\n",strerror(errno));
+   }
+}
+
+// book_write()
+
+static void book_write(FILE * file, const book_t * book) {
+
+   int pos, end;
+   uint64 score, max;
+   int shift;
+   uint8 * buf;
+   uint8 * data;
+   int buf_size;
+
+   ASSERT(file!=NULL);
+   ASSERT(book!=NULL);
+
+   // entries are encoded into a block and written with one call
+
+   buf = (uint8 *) my_malloc(WriteSize*16);
+   buf_size = 0;
+
    // entry loop
 
-   for (pos = 0; pos < Book->size; pos++) {
+   for (pos = 0; pos < book->size; pos = end) {
+
+      // scale the moves of a position by a common power of two so that
+      // the best one fits the weight field once rounded up, keeping the
+      // others non-zero
+
+      max = 0;
 
-      ASSERT(keep_entry(pos));
+      for (end = pos; end < book->size && book->entry[end].key == book->entry[pos].key; end++) {
+         score = entry_score(&book->entry[end]);
+         if (score > max) max = score;
+      }
+
+      for (shift = 0; ((max + (uint64(1) << shift) - 1) >> shift) > uint64(WeightMax); shift++)
+         ;
+
+      for (; pos < end; pos++) {
+
+         ASSERT(keep_entry(&book->entry[pos]));
+
+         score = entry_score(&book->entry[pos]);
+         score = (score + (uint64(1) << shift) - 1) >> shift;
+         ASSERT(score>0&&score<=uint64(WeightMax));
+
+         if (buf_size == WriteSize) {
+            write_block(file,buf,buf_size);
+            buf_size = 0;
+         }
 
-      write_integer(file,8,Book->entry[pos].key);
-      write_integer(file,2,Book->entry[pos].move);
-      write_integer(file,2,entry_score(&Book->entry[pos]));
-      write_integer(file,2,0);
-      write_integer(file,2,0);
+         data = &buf[buf_size*16];
+         buf_size++;
+
+         write_integer(&data[0],8,book->entry[pos].key);
+         write_integer(&data[8],2,book->entry[pos].move);
+         write_integer(&data[10],2,score);
+         write_integer(&data[12],2,0);
+         write_integer(&data[14],2,0);
+      }
    }
 
-   fclose(file);
+   write_block(file,buf,buf_size);
+
+   my_free(buf);
 }
 
-// find_entry()
+// spill_flush()
 
-static int find_entry(const board_t * board, int move) {
+static void spill_flush() {
 
-   uint64 key;
-   int index;
+   int i;
    int pos;
+   const entry_t * entry;
 
-   ASSERT(board!=NULL);
-   ASSERT(move_is_ok(move));
+   if (!Spilled) {
 
-   ASSERT(move_is_legal(move,board));
+      printf("table full (%d entries), spilling to temporary files ...\n",Book->size);
 
-   // init
+      for (i = 0; i < PartNb; i++) {
+         Part[i].entry = temp_open();
+      }
 
-   key = board->key;
+      Spilled = true;
+   }
 
-   // search
+   // entries are appended in creation order, so the first copy of a
+   // position/move in its partition is the one created first overall
 
-   for (index = key & Book->mask; (pos=Book->hash[index]) != NIL; index = (index+1) & Book->mask) {
+   for (pos = 0; pos < Book->size; pos++) {
+      entry = &Book->entry[pos];
+      if (fwrite(entry,sizeof(entry_t),1,Part[part_index(entry->key,0)].entry) != 1) {
+         my_fatal("spill_flush(): fwrite(): %s\n",strerror(errno));
+      }
+   }
 
-      ASSERT(pos>=0&&pos<Book->size);
+   // keep the allocation, empty the index
 
-      if (Book->entry[pos].key == key && Book->entry[pos].move == move) {
-         return pos; // found
-      }
+   Book->size = 0;
+   table_rehash(Book);
+}
+
+// spill_save()
+
+static void spill_save(const char file_name[]) {
+
+   FILE * file;
+   int i;
+
+   ASSERT(file_name!=NULL);
+   ASSERT(Spilled);
+
+   spill_flush(); // what was counted since the last flush
+
+   file = fopen(file_name,"wb");
+   if (file == NULL) my_fatal("spill_save(): can't open file \"%s\" for writing: %s\n",file_name,strerror(errno));
+
+   // partitions are key ranges in increasing order, so sorted partitions
+   // concatenate into a sorted book
+
+   for (i = 0; i < PartNb; i++) {
+      part_save(file,&Part[i],0);
    }
 
-   // not found
+   if (fclose(file) == EOF) {
+      my_fatal("spill_save(): fclose(): %s\n",strerror(errno));
+   }
+}
 
-   ASSERT(Book->size<=Book->alloc);
+// part_save()
 
-   if (Book->size == Book->alloc) {
+static void part_save(FILE * file, part_t * part, int level) {
 
-      // allocate more memory
+   entry_t entry[1];
+   sint64 size;
+   int pos;
 
-      resize();
+   ASSERT(file!=NULL);
+   ASSERT(part!=NULL);
+   ASSERT(level>=0&&level<PartLevelMax);
 
-      for (index = key & Book->mask; Book->hash[index] != NIL; index = (index+1) & Book->mask)
-         ;
+   // every flushed entry may be a new position/move
+
+   if (fseek(part->entry,0,SEEK_END) == -1) {
+      my_fatal("part_save(): fseek(): %s\n",strerror(errno));
    }
 
-   // create a new entry
+   size = ftell(part->entry);
+   if (size == -1) my_fatal("part_save(): ftell(): %s\n",strerror(errno));
 
-   ASSERT(Book->size<Book->alloc);
-   pos = Book->size++;
+   size /= sizeof(entry_t);
+   if (size > BookAllocMax) size = BookAllocMax;
 
-   Book->entry[pos].key = key;
-   Book->entry[pos].move = move;
-   Book->entry[pos].n = 0;
-   Book->entry[pos].sum = 0;
-   Book->entry[pos].colour = board->turn;
+   rewind(part->entry);
 
-   // insert into the hash table
+   table_free(Book);
+   table_init(Book,int(size));
 
-   ASSERT(index>=0&&index<Book->alloc*2);
-   ASSERT(Book->hash[index]==NIL);
-   Book->hash[index] = pos;
+   // sum the copies of each position/move, the first one sets the order
 
-   ASSERT(pos>=0&&pos<Book->size);
+   pos = 0;
 
-   return pos;
-}
+   while (fread(entry,sizeof(entry_t),1,part->entry) == 1) {
 
-// resize()
+      pos = find_entry(Book,entry->key,entry->move,entry->colour);
+      if (pos == NIL) break;
 
-static void resize() {
+      Book->entry[pos].n += entry->n;
+      Book->entry[pos].sum += entry->sum;
+   }
 
-   int size;
-   int pos;
-   int index;
+   if (pos == NIL) {
 
-   ASSERT(Book->size==Book->alloc);
+      // still too large, split on the next key bits
 
-   Book->alloc *= 2;
-   Book->mask = (Book->alloc * 2) - 1;
+      part_split(file,part,level);
 
-   size = 0;
-   size += Book->alloc * sizeof(entry_t);
-   size += (Book->alloc*2) * sizeof(sint32);
+   } else {
+
+      fclose(part->entry);
+
+      book_filter(Book);
+      book_sort(Book);
+      book_write(file,Book);
+   }
+
+   part->entry = NULL;
+}
+
+// part_split()
 
-   if (size >= 1048576) fprintf(stderr,"allocating %gMB ...\n",double(size)/1048576.0);
+static void part_split(FILE * file, part_t * part, int level) {
 
-   // resize arrays
+   part_t child[PartNb];
+   entry_t entry[1];
+   int i;
 
-   Book->entry = (entry_t *) my_realloc(Book->entry,Book->alloc*sizeof(entry_t));
-   Book->hash = (sint32 *) my_realloc(Book->hash,(Book->alloc*2)*sizeof(sint32));
+   ASSERT(file!=NULL);
+   ASSERT(part!=NULL);
+   ASSERT(level>=0&&level<PartLevelMax);
 
-   // rebuild hash table
+   if (level+1 >= PartLevelMax) my_fatal("part_split(): too many entries for one key\n");
 
-   for (index = 0; index < Book->alloc*2; index++) {
-      Book->hash[index] = NIL;
+   for (i = 0; i < PartNb; i++) {
+      child[i].entry = temp_open();
    }
 
-   for (pos = 0; pos < Book->size; pos++) {
+   rewind(part->entry);
 
-      for (index = Book->entry[pos].key & Book->mask; Book->hash[index] != NIL; index = (index+1) & Book->mask)
-         ;
+   while (fread(entry,sizeof(entry_t),1,part->entry) == 1) {
+      if (fwrite(entry,sizeof(entry_t),1,child[part_index(entry->key,level+1)].entry) != 1) {
+         my_fatal("part_split(): fwrite(): %s\n",strerror(errno));
+      }
+   }
 
-      ASSERT(index>=0&&index<Book->alloc*2);
-      Book->hash[index] = pos;
+   fclose(part->entry);
+
+   for (i = 0; i < PartNb; i++) {
+      part_save(file,&child[i],level+1);
    }
 }
 
-// halve_stats()
+// part_index()
+
+static int part_index(uint64 key, int level) {
+
+   ASSERT(level>=0&&level<PartLevelMax);
+
+   return int(key >> (64 - PartBits * (level + 1))) & (PartNb - 1);
+}
+
+// temp_open()
+
+static FILE * temp_open() {
+
+   FILE * file;
+   char * name;
+   int fd;
+
+   if (TmpDir == NULL) {
+
+      file = tmpfile();
+      if (file == NULL) my_fatal("temp_open(): tmpfile(): %s\n",strerror(errno));
+
+      return file;
+   }
+
+   name = (char *) my_malloc(strlen(TmpDir)+32);
+   sprintf(name,"%s/polyglot-XXXXXX",TmpDir);
+
+   fd = mkstemp(name);
+   if (fd == -1) my_fatal("temp_open(): mkstemp(): %s: %s\n",name,strerror(errno));
+
+   unlink(name); // removed on close
 
-static void halve_stats(uint64 key) {
+   file = fdopen(fd,"w+b");
+   if (file == NULL) my_fatal("temp_open(): fdopen(): %s\n",strerror(errno));
+
+   my_free(name);
+
+   return file;
+}
+
+// find_entry()
+
+static int find_entry(book_t * book, uint64 key, int move, int colour) {
 
-   int index;
    int pos;
 
+   ASSERT(book!=NULL);
+   ASSERT(move_is_ok(move));
+   ASSERT(colour_is_ok(colour));
+
    // search
 
-   for (index = key & Book->mask; (pos=Book->hash[index]) != NIL; index = (index+1) & Book->mask) {
+   pos = table_find(book,key,move);
+   if (pos != TableNone) return pos; // found
 
-      ASSERT(pos>=0&&pos<Book->size);
+   // not found
 
-      if (Book->entry[pos].key == key) {
-         Book->entry[pos].n = (Book->entry[pos].n + 1) / 2;
-         Book->entry[pos].sum = (Book->entry[pos].sum + 1) / 2;
-      }
-   }
+   if (BookAllocMax != 0 && book->size == book->alloc && book->alloc >= BookAllocMax) return NIL; // full
+
+   // create a new entry
+
+   pos = table_insert(book,key,move);
+   book->entry[pos].colour = colour;
+
+   ASSERT(pos>=0&&pos<book->size);
+
+   return pos;
 }
 
 // keep_entry()
 
-static bool keep_entry(int pos) {
+static bool keep_entry(const entry_t * entry) {
 
-   const entry_t * entry;
    int colour;
    double score;
 
-   ASSERT(pos>=0&&pos<Book->size);
-
-   entry = &Book->entry[pos];
+   ASSERT(entry!=NULL);
 
    // if (entry->n == 0) return false;
-   if (entry->n < MinGame) return false;
+   if (sint64(entry->n) < MinGame) return false;
 
    if (entry->sum == 0) return false;
 
@@ -487,9 +964,9 @@ static bool keep_entry(int pos) {
 
 // entry_score()
 
-static int entry_score(const entry_t * entry) {
+static uint64 entry_score(const entry_t * entry) {
 
-   int score;
+   uint64 score;
 
    ASSERT(entry!=NULL);
 
@@ -498,11 +975,11 @@ static int entry_score(const entry_t * entry) {
 
    if (Uniform) score = 1;
 
-   ASSERT(score>=0);
-
    return score;
 }
 
+#if DEBUG
+
 // key_compare()
 
 static int key_compare(const void * p1, const void * p2) {
@@ -519,26 +996,109 @@ static int key_compare(const void * p1, const void * p2) {
       return +1;
    } else if (entry_1->key < entry_2->key) {
       return -1;
+   } else if (entry_score(entry_1) < entry_score(entry_2)) {
+      return +1; // highest score first
+   } else if (entry_score(entry_1) > entry_score(entry_2)) {
+      return -1;
    } else {
-      return entry_score(entry_2) - entry_score(entry_1); // highest score first
+      return 0;
    }
 }
 
-// write_integer()
+#endif
 
-static void write_integer(FILE * file, int size, uint64 n) {
+// entry_sort()
 
+static void entry_sort(entry_t * entry, entry_t * tmp, int size) {
+
+   int count[DigitNb][256];
+   entry_t * src, * dst, * swap;
+   int digit;
    int i;
    int b;
+   int pos, n;
+
+   ASSERT(entry!=NULL);
+   ASSERT(tmp!=NULL||size<=1);
+   ASSERT(size>=0);
+
+   // LSD radix sort, each pass is stable: scores (highest first) then
+   // keys gives the key_compare() order with ties in creation order
+
+   if (size <= 1) return;
+
+   memset(count,0,sizeof(count));
+
+   for (i = 0; i < size; i++) {
+      for (digit = 0; digit < DigitNb; digit++) count[digit][entry_digit(&entry[i],digit)]++;
+   }
+
+   src = entry;
+   dst = tmp;
+
+   for (digit = 0; digit < DigitNb; digit++) {
+
+      if (count[digit][entry_digit(&src[0],digit)] == size) continue; // same byte everywhere
+
+      pos = 0;
+
+      for (b = 0; b < 256; b++) {
+         n = count[digit][b];
+         count[digit][b] = pos;
+         pos += n;
+      }
+
+      for (i = 0; i < size; i++) {
+         dst[count[digit][entry_digit(&src[i],digit)]++] = src[i];
+      }
+
+      swap = src;
+      src = dst;
+      dst = swap;
+   }
+
+   if (src != entry) memcpy(entry,src,size*sizeof(entry_t));
+}
+
+// entry_digit()
+
+static int entry_digit(const entry_t * entry, int digit) {
+
+   ASSERT(entry!=NULL);
+   ASSERT(digit>=0&&digit<DigitNb);
+
+   if (digit < 8) {
+      return int((~entry_score(entry) >> (digit * 8)) & 0xFF);
+   } else {
+      return int((entry->key >> ((digit - 8) * 8)) & 0xFF);
+   }
+}
+
+// write_block()
+
+static void write_block(FILE * file, const uint8 * data, int size) {
 
    ASSERT(file!=NULL);
+   ASSERT(data!=NULL);
+   ASSERT(size>=0&&size<=WriteSize);
+
+   if (fwrite(data,16,size,file) != size_t(size)) {
+      my_fatal("write_block(): fwrite(): %s\n",strerror(errno));
+   }
+}
+
+// write_integer()
+
+static void write_integer(uint8 * data, int size, uint64 n) {
+
+   int i;
+
+   ASSERT(data!=NULL);
    ASSERT(size>0&&size<=8);
    ASSERT(size==8||n>>(size*8)==0);
 
    for (i = size-1; i >= 0; i--) {
-      b = (n >> (i*8)) & 0xFF;
-      ASSERT(b>=0&&b<256);
-      fputc(b,file);
+      *data++ = (n >> (i*8)) & 0xFF;
    }
 }
 
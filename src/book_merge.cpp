@@ -4,19 +4,29 @@
 // includes
 
 #include <cerrno>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "book_merge.h"
 #include "util.h"
 
-// types
+// constants
 
-struct book_t {
-   FILE * file;
-   int size;
-};
+static const bool UseMmap = true;
+
+static const int BookMax = 256;
+static const int MoveMax = 256; // distinct moves in a position
+
+static const int WeightMax = 65535; // 16-bit book fields
+
+static const int ReadSize = 4096; // entries per read block when not mapped
+static const int WriteSize = 65536; // entries per write block
+
+// types
 
 struct entry_t {
    uint64 key;
@@ -26,24 +36,62 @@ struct entry_t {
    uint16 sum;
 };
 
+struct book_t {
+   FILE * file;
+   sint64 size;
+   sint64 pos; // entries consumed, reading only
+   const uint8 * data;
+   bool mapped;
+   uint8 * buf;
+   int buf_size; // entries in buf
+   int buf_pos;
+   entry_t entry[1]; // current entry, reading only
+   double scale; // weight factor for -combine
+};
+
+struct combine_t {
+   uint16 move;
+   double weight;
+   uint64 n;
+   uint64 sum;
+};
+
 // variables
 
-static book_t In1[1];
-static book_t In2[1];
+static int InNb;
+static book_t In[BookMax];
 static book_t Out[1];
 
+static int HeapSize;
+static int Heap[BookMax]; // indices into In[], smallest key first
+
+static bool Combine;
+static int CombineNb;
+static combine_t CombineMove[MoveMax];
+
 // prototypes
 
 static void   book_clear    (book_t * book);
 
-static void   book_open     (book_t * book, const char file_name[], const char mode[]);
+static void   book_open     (book_t * book, const char file_name[]);
+static void   book_create   (book_t * book, const char file_name[]);
 static void   book_close    (book_t * book);
 
-static bool   read_entry    (book_t * book, entry_t * entry, int n);
+static bool   read_entry    (book_t * book);
 static void   write_entry   (book_t * book, const entry_t * entry);
+static void   write_flush   (book_t * book);
 
-static uint64 read_integer  (FILE * file, int size);
-static void   write_integer (FILE * file, int size, uint64 n);
+static int    combine_position (uint64 key);
+static void   combine_add   (const entry_t * entry, double scale);
+static void   combine_write (uint64 key);
+
+static bool   heap_less     (int i, int j);
+static void   heap_push     (int i);
+static void   heap_pop      ();
+static void   heap_down     ();
+
+static uint64 read_integer  (const uint8 * data, int size);
+static void   write_integer (uint8 * data, int size, uint64 n);
 
 // functions
 
@@ -54,11 +102,17 @@ void book_merge(int argc, char * argv[]) {
    int i;
    const char * in_file_1;
    const char * in_file_2;
+   const char * in_file[BookMax];
+   double scale_1, scale_2;
+   double in_scale[BookMax];
+   double * scale;
+   bool scaled;
+   int in_nb;
    const char * out_file;
-   int i1, i2;
-   bool b1, b2;
-   entry_t e1[1], e2[1];
+   uint64 key;
+   bool more;
    int skip;
+   int combined;
 
    in_file_1 = NULL;
    my_string_clear(&in_file_1);
@@ -66,9 +120,18 @@ void book_merge(int argc, char * argv[]) {
    in_file_2 = NULL;
    my_string_clear(&in_file_2);
 
+   scale_1 = 1.0;
+   scale_2 = 1.0;
+   scale = NULL;
+   scaled = false;
+
+   in_nb = 0;
+
    out_file = NULL;
    my_string_set(&out_file,"out.bin");
 
+   Combine = false;
+
    for (i = 1; i < argc; i++) {
 
       if (false) {
@@ -83,6 +146,7 @@ void book_merge(int argc, char * argv[]) {
          if (argv[i] == NULL) my_fatal("book_merge(): missing argument\n");
 
          my_string_set(&in_file_1,argv[i]);
+         scale = &scale_1;
 
       } else if (my_string_equal(argv[i],"-in2")) {
 
@@ -90,6 +154,35 @@ void book_merge(int argc, char * argv[]) {
          if (argv[i] == NULL) my_fatal("book_merge(): missing argument\n");
 
          my_string_set(&in_file_2,argv[i]);
+         scale = &scale_2;
+
+      } else if (my_string_equal(argv[i],"-in")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("book_merge(): missing argument\n");
+
+         if (in_nb >= BookMax - 2) my_fatal("book_merge(): too many input files\n");
+
+         in_file[in_nb] = NULL;
+         my_string_set(&in_file[in_nb],argv[i]);
+         in_scale[in_nb] = 1.0;
+         scale = &in_scale[in_nb++];
+
+      } else if (my_string_equal(argv[i],"-scale")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("book_merge(): missing argument\n");
+
+         if (scale == NULL) my_fatal("book_merge(): -scale must follow an input file\n");
+
+         *scale = atof(argv[i]);
+         if (*scale <= 0.0) my_fatal("book_merge(): invalid scale \"%s\"\n",argv[i]);
+
+         scaled = true;
+
+      } else if (my_string_equal(argv[i],"-combine")) {
+
+         Combine = true;
 
       } else if (my_string_equal(argv[i],"-out")) {
 
@@ -104,68 +197,95 @@ void book_merge(int argc, char * argv[]) {
       }
    }
 
-   book_clear(In1);
-   book_clear(In2);
-   book_clear(Out);
+   if (scaled && !Combine) my_fatal("book_merge(): -scale needs -combine\n");
 
-   book_open(In1,in_file_1,"rb");
-   book_open(In2,in_file_2,"rb");
-   book_open(Out,out_file,"wb");
+   // inputs in priority order: -in1, -in2, then each -in
 
-   skip = 0;
+   InNb = 0;
+
+   if (in_file_1 != NULL) {
+      book_open(&In[InNb],in_file_1);
+      In[InNb++].scale = scale_1;
+   }
 
-   i1 = 0;
-   i2 = 0;
+   if (in_file_2 != NULL) {
+      book_open(&In[InNb],in_file_2);
+      In[InNb++].scale = scale_2;
+   }
 
-   while (true) {
+   for (i = 0; i < in_nb; i++) {
+      book_open(&In[InNb],in_file[i]);
+      In[InNb++].scale = in_scale[i];
+   }
 
-      b1 = read_entry(In1,e1,i1);
-      b2 = read_entry(In2,e2,i2);
+   if (InNb == 0) my_fatal("book_merge(): no input file\n");
 
-      if (false) {
+   book_create(Out,out_file);
 
-      } else if (!b1 && !b2) {
+   // k-way merge, a position is taken from the first input that has it
+
+   HeapSize = 0;
+
+   for (i = 0; i < InNb; i++) {
+      if (read_entry(&In[i])) heap_push(i);
+   }
 
-         break;
+   skip = 0;
+   combined = 0;
 
-      } else if (b1 && !b2) {
+   while (HeapSize != 0) {
 
-         write_entry(Out,e1);
-         i1++;
+      i = Heap[0];
+      key = In[i].entry->key;
 
-      } else if (b2 && !b1) {
+      if (Combine) {
+         combined += combine_position(key);
+         continue;
+      }
 
-         write_entry(Out,e2);
-         i2++;
+      do {
+         write_entry(Out,In[i].entry);
+      } while ((more = read_entry(&In[i])) && In[i].entry->key == key);
 
+      if (more) {
+         heap_down();
       } else {
+         heap_pop();
+      }
 
-         ASSERT(b1);
-         ASSERT(b2);
+      // lower-priority copies of the same position
 
-         if (false) {
-         } else if (e1->key < e2->key) {
-            write_entry(Out,e1);
-            i1++;
-         } else if (e1->key > e2->key) {
-            write_entry(Out,e2);
-            i2++;
-         } else {
-            ASSERT(e1->key==e2->key);
+      while (HeapSize != 0 && In[Heap[0]].entry->key == key) {
+
+         i = Heap[0];
+
+         do {
             skip++;
-            i2++;
+         } while ((more = read_entry(&In[i])) && In[i].entry->key == key);
+
+         if (more) {
+            heap_down();
+         } else {
+            heap_pop();
          }
       }
    }
 
-   book_close(In1);
-   book_close(In2);
+   for (i = 0; i < InNb; i++) book_close(&In[i]);
+
+   write_flush(Out);
    book_close(Out);
 
+   for (i = 0; i < in_nb; i++) my_string_clear(&in_file[i]);
+
    if (skip != 0) {
       printf("skipped %d entr%s.\n",skip,(skip>1)?"ies":"y");
    }
 
+   if (combined != 0) {
+      printf("combined %d entr%s.\n",combined,(combined>1)?"ies":"y");
+   }
+
    printf("done!\n");
 }
 
@@ -177,17 +297,27 @@ static void book_clear(book_t * book) {
 
    book->file = NULL;
    book->size = 0;
+   book->pos = 0;
+   book->data = NULL;
+   book->mapped = false;
+   book->buf = NULL;
+   book->buf_size = 0;
+   book->buf_pos = 0;
+   book->scale = 1.0;
 }
 
 // book_open()
 
-static void book_open(book_t * book, const char file_name[], const char mode[]) {
+static void book_open(book_t * book, const char file_name[]) {
+
+   void * address;
 
    ASSERT(book!=NULL);
    ASSERT(file_name!=NULL);
-   ASSERT(mode!=NULL);
 
-   book->file = fopen(file_name,mode);
+   book_clear(book);
+
+   book->file = fopen(file_name,"rb");
    if (book->file == NULL) my_fatal("book_open(): can't open file \"%s\": %s\n",file_name,strerror(errno));
 
    if (fseek(book->file,0,SEEK_END) == -1) {
@@ -195,6 +325,44 @@ static void book_open(book_t * book, const char file_name[], const char mode[])
    }
 
    book->size = ftell(book->file) / 16;
+
+   // the merge reads each file once from start to end
+
+   if (UseMmap && book->size != 0) {
+
+      address = mmap(NULL,book->size*16,PROT_READ,MAP_PRIVATE,fileno(book->file),0);
+
+      if (address != MAP_FAILED) {
+         madvise(address,book->size*16,MADV_SEQUENTIAL);
+         book->data = (const uint8 *) address;
+         book->mapped = true;
+      }
+   }
+
+   if (!book->mapped) {
+
+      if (fseek(book->file,0,SEEK_SET) == -1) {
+         my_fatal("book_open(): fseek(): %s\n",strerror(errno));
+      }
+
+      book->buf = (uint8 *) my_malloc(ReadSize*16);
+      book->data = book->buf;
+   }
+}
+
+// book_create()
+
+static void book_create(book_t * book, const char file_name[]) {
+
+   ASSERT(book!=NULL);
+   ASSERT(file_name!=NULL);
+
+   book_clear(book);
+
+   book->file = fopen(file_name,"wb");
+   if (book->file == NULL) my_fatal("book_create(): can't open file \"%s\": %s\n",file_name,strerror(errno));
+
+   book->buf = (uint8 *) my_malloc(WriteSize*16);
 }
 
 // book_close()
@@ -203,31 +371,57 @@ static void book_close(book_t * book) {
 
    ASSERT(book!=NULL);
 
+   if (book->mapped) munmap((void *)book->data,book->size*16);
+   if (book->buf != NULL) my_free(book->buf);
+
    if (fclose(book->file) == EOF) {
       my_fatal("book_close(): fclose(): %s\n",strerror(errno));
    }
+
+   book_clear(book);
 }
 
 // read_entry()
 
-static bool read_entry(book_t * book, entry_t * entry, int n) {
+static bool read_entry(book_t * book) {
+
+   const uint8 * data;
+   sint64 n;
 
    ASSERT(book!=NULL);
-   ASSERT(entry!=NULL);
 
-   if (n < 0 || n >= book->size) return false;
+   if (book->pos >= book->size) return false;
+
+   if (book->mapped) {
+
+      data = &book->data[book->pos*16];
+
+   } else {
+
+      if (book->buf_pos == book->buf_size) {
+
+         n = book->size - book->pos;
+         if (n > ReadSize) n = ReadSize;
 
-   ASSERT(n>=0&&n<book->size);
+         if (fread(book->buf,16,n,book->file) != size_t(n)) {
+            my_fatal("read_entry(): fread(): %s\n",feof(book->file)?"EOF reached":strerror(errno));
+         }
+
+         book->buf_size = int(n);
+         book->buf_pos = 0;
+      }
 
-   if (fseek(book->file,n*16,SEEK_SET) == -1) {
-      my_fatal("read_entry(): fseek(): %s\n",strerror(errno));
+      data = &book->buf[book->buf_pos*16];
+      book->buf_pos++;
    }
 
-   entry->key   = read_integer(book->file,8);
-   entry->move  = read_integer(book->file,2);
-   entry->count = read_integer(book->file,2);
-   entry->n     = read_integer(book->file,2);
-   entry->sum   = read_integer(book->file,2);
+   book->pos++;
+
+   book->entry->key   = read_integer(&data[0],8);
+   book->entry->move  = read_integer(&data[8],2);
+   book->entry->count = read_integer(&data[10],2);
+   book->entry->n     = read_integer(&data[12],2);
+   book->entry->sum   = read_integer(&data[14],2);
 
    return true;
 }
@@ -236,69 +430,245 @@ static bool read_entry(book_t * book, entry_t * entry, int n) {
 
 static void write_entry(book_t * book, const entry_t * entry) {
 
+   uint8 * data;
+
    ASSERT(book!=NULL);
    ASSERT(entry!=NULL);
 
-   write_integer(book->file,8,entry->key);
-   write_integer(book->file,2,entry->move);
-   write_integer(book->file,2,entry->count);
-   write_integer(book->file,2,entry->n);
-   write_integer(book->file,2,entry->sum);
+   if (book->buf_size == WriteSize) write_flush(book);
+
+   data = &book->buf[book->buf_size*16];
+   book->buf_size++;
+
+   write_integer(&data[0],8,entry->key);
+   write_integer(&data[8],2,entry->move);
+   write_integer(&data[10],2,entry->count);
+   write_integer(&data[12],2,entry->n);
+   write_integer(&data[14],2,entry->sum);
 }
 
-// read_integer()
+// write_flush()
 
-static uint64 read_integer(FILE * file, int size) {
+static void write_flush(book_t * book) {
+
+   ASSERT(book!=NULL);
+
+   if (fwrite(book->buf,16,book->buf_size,book->file) != size_t(book->buf_size)) {
+      my_fatal("write_flush(): fwrite(): %s\n",strerror(errno));
+   }
+
+   book->size += book->buf_size;
+   book->buf_size = 0;
+}
+
+// combine_position()
+
+static int combine_position(uint64 key) {
 
-   uint64 n;
    int i;
-   int b;
+   int entry_nb;
+   bool more;
 
-   ASSERT(file!=NULL);
-   ASSERT(size>0&&size<=8);
+   ASSERT(HeapSize>0);
+   ASSERT(In[Heap[0]].entry->key==key);
 
-   n = 0;
+   // gather the position from every input, in priority order
 
-   for (i = 0; i < size; i++) {
+   CombineNb = 0;
+   entry_nb = 0;
 
-      b = fgetc(file);
+   while (HeapSize != 0 && In[Heap[0]].entry->key == key) {
 
-      if (b == EOF) {
-         if (feof(file)) {
-            my_fatal("read_integer(): fgetc(): EOF reached\n");
-         } else { // error
-            my_fatal("read_integer(): fgetc(): %s\n",strerror(errno));
-         }
+      i = Heap[0];
+
+      do {
+         combine_add(In[i].entry,In[i].scale);
+         entry_nb++;
+      } while ((more = read_entry(&In[i])) && In[i].entry->key == key);
+
+      if (more) {
+         heap_down();
+      } else {
+         heap_pop();
+      }
+   }
+
+   combine_write(key);
+
+   return entry_nb - CombineNb;
+}
+
+// combine_add()
+
+static void combine_add(const entry_t * entry, double scale) {
+
+   int i;
+   combine_t * move;
+
+   ASSERT(entry!=NULL);
+   ASSERT(scale>0.0);
+
+   for (i = 0; i < CombineNb; i++) {
+      if (CombineMove[i].move == entry->move) break;
+   }
+
+   move = &CombineMove[i];
+
+   if (i == CombineNb) {
+
+      if (CombineNb >= MoveMax) my_fatal("combine_add(): too many moves in position\n");
+      CombineNb++;
+
+      move->move = entry->move;
+      move->weight = 0.0;
+      move->n = 0;
+      move->sum = 0;
+   }
+
+   move->weight += double(entry->count) * scale;
+   move->n += entry->n;
+   move->sum += entry->sum;
+}
+
+// combine_write()
+
+static void combine_write(uint64 key) {
+
+   int i, j;
+   combine_t move;
+   double max, unit;
+   entry_t entry[1];
+
+   // highest weight first, ties keep input order
+
+   for (i = 1; i < CombineNb; i++) {
+      move = CombineMove[i];
+      for (j = i; j > 0 && CombineMove[j-1].weight < move.weight; j--) {
+         CombineMove[j] = CombineMove[j-1];
+      }
+      CombineMove[j] = move;
+   }
+
+   // scale the moves by a common power of two so that the best one fits
+   // the weight field, rounding up to keep the others non-zero
+
+   max = (CombineNb != 0) ? CombineMove[0].weight : 0.0;
+
+   for (unit = 1.0; max > double(WeightMax) * unit; unit *= 2.0)
+      ;
+
+   for (i = 0; i < CombineNb; i++) {
+
+      // learning statistics keep their ratio
+
+      while (CombineMove[i].n > uint64(WeightMax) || CombineMove[i].sum > uint64(WeightMax)) {
+         CombineMove[i].n /= 2;
+         CombineMove[i].sum /= 2;
       }
 
-      ASSERT(b>=0&&b<256);
-      n = (n << 8) | b;
+      entry->key = key;
+      entry->move = CombineMove[i].move;
+      entry->count = uint16(ceil(CombineMove[i].weight / unit));
+      entry->n = uint16(CombineMove[i].n);
+      entry->sum = uint16(CombineMove[i].sum);
+
+      write_entry(Out,entry);
    }
+}
+
+// heap_less()
+
+static bool heap_less(int i, int j) {
+
+   ASSERT(i>=0&&i<InNb);
+   ASSERT(j>=0&&j<InNb);
+
+   // equal keys: the earlier input has priority
+
+   if (In[i].entry->key != In[j].entry->key) return In[i].entry->key < In[j].entry->key;
+
+   return i < j;
+}
+
+// heap_push()
+
+static void heap_push(int i) {
+
+   int pos, parent;
+
+   ASSERT(HeapSize<BookMax);
+
+   for (pos = HeapSize++; pos > 0; pos = parent) {
+      parent = (pos - 1) / 2;
+      if (!heap_less(i,Heap[parent])) break;
+      Heap[pos] = Heap[parent];
+   }
+
+   Heap[pos] = i;
+}
+
+// heap_pop()
+
+static void heap_pop() {
+
+   ASSERT(HeapSize>0);
+
+   Heap[0] = Heap[--HeapSize];
+   if (HeapSize != 0) heap_down();
+}
+
+// heap_down()
+
+static void heap_down() {
+
+   int i;
+   int pos, child;
+
+   ASSERT(HeapSize>0);
+
+   // restore the order after the top input moved on
+
+   i = Heap[0];
+
+   for (pos = 0; (child = pos * 2 + 1) < HeapSize; pos = child) {
+      if (child + 1 < HeapSize && heap_less(Heap[child+1],Heap[child])) child++;
+      if (!heap_less(Heap[child],i)) break;
+      Heap[pos] = Heap[child];
+   }
+
+   Heap[pos] = i;
+}
+
+// read_integer()
+
+static uint64 read_integer(const uint8 * data, int size) {
+
+   uint64 n;
+   int i;
+
+   ASSERT(data!=NULL);
+   ASSERT(size>0&&size<=8);
+
+   n = 0;
+
+   for (i = 0; i < size; i++) n = (n << 8) | data[i];
 
    return n;
 }
 
 // write_integer()
 
-static void write_integer(FILE * file, int size, uint64 n) {
+static void write_integer(uint8 * data, int size, uint64 n) {
 
    int i;
-   int b;
 
-   ASSERT(file!=NULL);
+   ASSERT(data!=NULL);
    ASSERT(size>0&&size<=8);
    ASSERT(size==8||n>>(size*8)==0);
 
    for (i = size-1; i >= 0; i--) {
-
-      b = (n >> (i*8)) & 0xFF;
-      ASSERT(b>=0&&b<256);
-
-      if (fputc(b,file) == EOF) {
-         my_fatal("write_integer(): fputc(): %s\n",strerror(errno));
-      }
+      *data++ = (n >> (i*8)) & 0xFF;
    }
 }
 
 // end of book_merge.cpp
-
@@ -8,17 +8,22 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <unistd.h>
 
+#include "bloom.h"
 #include "board.h"
 #include "elo_book.h"
+#include "ingest.h"
 #include "move.h"
 #include "move_do.h"
 #include "move_legal.h"
 #include "pgn.h"
 #include "san.h"
+#include "table.h"
+#include "thread.h"
 #include "util.h"
 
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
@@ -26,9 +31,18 @@
 
 // constants
 
-static const int COUNT_MAX = 16384;
+static const int OutBufSize = 1 << 20;
+static const int ChunkBufSize = 64 * 1024;
 
-static const int NIL = -1;
+static const int FieldMax = 15;
+
+static const char OutMagic[8] = { 'E', 'L', 'O', 'B', 'O', 'O', 'K', '1' };
+
+static const bool UseMmap = true;
+
+static const char ModelMagic[8] = { 'E', 'L', 'O', 'M', 'O', 'D', 'E', 'L' };
+static const uint32 ModelVersion = 1;
+static const uint64 ModelByteOrder = 0x0102030405060708ULL;
 
 // types
 
@@ -43,22 +57,47 @@ struct elopath_stats {
 
 struct entry_t {
    uint64 key;
+   uint64 n;
+   uint64 elo_sum;
+   uint64 elo_sumsq;
+   uint32 gamenum;
+   uint16 move;
+   uint16 elo_min;
+   uint16 elo_max;
+   uint8 terminal;
+};
+
+typedef table_t<entry_t> book_t;
+
+struct model_header_t { // 64 bytes
+   char magic[8];
+   uint32 version;
+   uint32 entry_size;
+   uint64 byte_order;
+   sint64 size;
+   sint64 alloc;
+   uint64 reserved[3];
+};
+
+struct record_t {
+   uint64 key;
+   sint32 elo;
+   uint32 gamenum;
    uint16 move;
-   uint16 n;
-  uint16 terminal;
-  uint16 gamenum;
-  uint32 elo_sum;
-  uint32 elo_min;
-  uint32 elo_max;
-  uint64 elo_sumsq;
+   uint8 terminal;
 };
 
-struct book_t {
+struct out_t {
+   char * buf;
    int size;
    int alloc;
-   uint32 mask;
-   entry_t * entry;
-   sint32 * hash;
+   bool flush; // written to stdout when full, otherwise grows
+};
+
+struct eloize_t {
+   bool exact_match;
+   out_t * out; // per window slot
+   int game_nb;
 };
 
 // variables
@@ -68,18 +107,59 @@ static int MinGame;
 static double MinScore;
 static bool RemoveWhite, RemoveBlack;
 static bool Uniform;
+static int Threads;
+static sint64 ExpectedPositions;
+
+static bool OutBinary;
+static out_t Out[1];
+static bool BloomFilter;
 
 static book_t Book[1];
+static bloom_t Bloom[1];
+
+static void * ModelData; // mapped or allocated model file
+static sint64 ModelSize;
+static bool ModelMapped;
+
+static int ShardNb;
+static book_t Shard[ThreadMax];
 
 // prototypes
 
-static void   book_clear    ();
+static void   book_clear    (book_t * book, int hint);
 static void   book_insert   (const char file_name[], bool exact_match);
+static void   book_bloom    ();
 static void   eloize_games  (const char file_name[], bool exact_match);
-
-static int    find_entry    (const board_t * board, int move, bool create);
-static void   resize        ();
-static void   halve_stats   (uint64 key);
+static void   eloize_game   (pgn_t * pgn, bool exact_match, out_t * out);
+static void   eloize_parallel (const pgn_t * pgn, bool exact_match);
+static void   eloize_map    (pgn_t * pgn, int slot, void * data);
+static void   eloize_write  (int slot, int game_nb, void * data);
+
+static void   model_save    (const char file_name[]);
+static void   model_load    (book_t * book, const char file_name[]);
+static void   model_close   (book_t * book);
+static void   model_update  (const char file_name[]);
+static void   entry_merge   (entry_t * dst, const entry_t * src);
+static int    entry_stdev   (const entry_t * entry);
+static int    entry_compare (const void * p1, const void * p2);
+
+static void   out_open      (bool exact_match);
+static void   out_close     ();
+static void   out_init      (out_t * out, int alloc, bool flush);
+static void   out_free      (out_t * out);
+static void   out_reserve   (out_t * out, int size);
+static void   out_flush     (out_t * out);
+static void   out_append    (out_t * out, const out_t * src);
+static void   out_record    (out_t * out, const char event[], const int field[], int field_nb);
+static void   out_string    (out_t * out, const char string[]);
+static void   out_int       (out_t * out, int n);
+static void   out_le32      (out_t * out, uint32 n);
+
+static int    find_entry    (book_t * book, uint64 key, int move, bool create);
+
+static void   game_records  (pgn_t * pgn, record_list_t list[]);
+static void   record_add    (record_list_t * list, const board_t * board, int move, int elo, int gamenum);
+static void   list_apply    (int shard, record_list_t * list);
 
 
 
@@ -90,11 +170,15 @@ static void   halve_stats   (uint64 key);
 void elo_book(int argc, char * argv[]) {
 
    int i;
+   int hint;
    const char * train_pgn_files[100];
    int num_train_files = 0;
    const char * input_pgn_files[100];
    int num_input_files = 0;
    const char * bin_file;
+   const char * save_model;
+   const char * load_model;
+   const char * update_model;
    bool exact_match = false;
 
    struct stat buf;
@@ -103,6 +187,10 @@ void elo_book(int argc, char * argv[]) {
    bin_file = NULL;
    my_string_set(&bin_file,"book.bin");
 
+   save_model = NULL;
+   load_model = NULL;
+   update_model = NULL;
+
    // zero out these pointers because otherwise my_string_set() will
    // attempt to free() them
    for (i=0; i<100; i++) {
@@ -111,6 +199,10 @@ void elo_book(int argc, char * argv[]) {
    }
 
    MaxPly = 1024;
+   Threads = 1;
+   ExpectedPositions = 0;
+   BloomFilter = false;
+   OutBinary = false;
 
    for (i = 1; i < argc; i++) {
 
@@ -154,13 +246,90 @@ void elo_book(int argc, char * argv[]) {
 
          my_string_set(&bin_file,argv[i]);
 
+      } else if (my_string_equal(argv[i],"-expected-positions")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("elo_book(): missing argument\n");
+
+         ExpectedPositions = my_atoll(argv[i]);
+         if (ExpectedPositions < 0) my_fatal("elo_book(): invalid number of positions\n");
+
+      } else if (my_string_equal(argv[i],"-bloom")) {
+
+         BloomFilter = true;
+
+      } else if (my_string_equal(argv[i],"-save-model")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("elo_book(): missing argument\n");
+
+         my_string_set(&save_model,argv[i]);
+
+      } else if (my_string_equal(argv[i],"-load-model")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("elo_book(): missing argument\n");
+
+         my_string_set(&load_model,argv[i]);
+
+      } else if (my_string_equal(argv[i],"-update-model")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("elo_book(): missing argument\n");
+
+         my_string_set(&update_model,argv[i]);
+
+      } else if (my_string_equal(argv[i],"-out-format")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("elo_book(): missing argument\n");
+
+         if (my_string_equal(argv[i],"csv")) {
+            OutBinary = false;
+         } else if (my_string_equal(argv[i],"binary")) {
+            OutBinary = true;
+         } else {
+            my_fatal("elo_book(): unknown output format \"%s\"\n",argv[i]);
+         }
+
+      } else if (my_string_equal(argv[i],"-threads")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("elo_book(): missing argument\n");
+
+         Threads = atoi(argv[i]);
+         if (Threads <= 0) Threads = thread_nb_default();
+         if (Threads > ThreadMax) Threads = ThreadMax;
+
       } else {
 
          my_fatal("elo_book(): unknown option \"%s\"\n",argv[i]);
       }
    }
 
-   book_clear();
+   if (load_model != NULL && num_train_files != 0) {
+      my_fatal("elo_book(): can't use -train-pgn with -load-model\n");
+   }
+
+   if (load_model != NULL && update_model != NULL) {
+      my_fatal("elo_book(): can't use -load-model with -update-model\n");
+   }
+
+   ShardNb = Threads;
+
+   // size the shards for the whole input, keys spread evenly over them
+
+   if (ExpectedPositions == 0) {
+      for (i = 0; i < num_train_files; i++) {
+         ExpectedPositions += table_estimate(my_file_size(train_pgn_files[i]),MaxPly);
+      }
+   }
+
+   hint = (ExpectedPositions / ShardNb > TableAllocMax) ? TableAllocMax : int(ExpectedPositions / ShardNb + 1);
+
+   for (i = 0; i < ShardNb; i++) {
+      book_clear(&Shard[i],hint);
+   }
 
    for (i=0; i<num_train_files; i++) {
      stat(train_pgn_files[i], &buf);
@@ -186,6 +355,31 @@ void elo_book(int argc, char * argv[]) {
 
    }
 
+   table_join(Book,Shard,ShardNb);
+
+   if (load_model != NULL) {
+      fprintf(stderr, "loading model from %s ...\n", load_model);
+      table_free(Book);
+      model_load(Book,load_model);
+   }
+
+   if (update_model != NULL) {
+
+      fprintf(stderr, "merging into model %s ...\n", update_model);
+      model_update(update_model);
+
+      if (save_model == NULL) my_string_set(&save_model,update_model);
+   }
+
+   if (save_model != NULL) {
+      fprintf(stderr, "saving model to %s ...\n", save_model);
+      model_save(save_model);
+   }
+
+   if (BloomFilter) book_bloom();
+
+   out_open(exact_match);
+
    for (i=0; i<num_input_files; i++) {
      stat(input_pgn_files[i], &buf);
      if (buf.st_mode & S_IFDIR) {
@@ -209,25 +403,23 @@ void elo_book(int argc, char * argv[]) {
      }
    }
 
+   out_close();
+
+   if (BloomFilter) bloom_free(Bloom);
+
+   if (ModelData != NULL) model_close(Book);
+
    fputs("all done!\n", stderr);
 }
 
 // book_clear()
 
-static void book_clear() {
-
-   int index;
-
-   Book->alloc = 1;
-   Book->mask = (Book->alloc * 2) - 1;
+static void book_clear(book_t * book, int hint) {
 
-   Book->entry = (entry_t *) my_malloc(Book->alloc*sizeof(entry_t));
-   Book->size = 0;
+   ASSERT(book!=NULL);
+   ASSERT(hint>=0);
 
-   Book->hash = (sint32 *) my_malloc((Book->alloc*2)*sizeof(sint32));
-   for (index = 0; index < Book->alloc*2; index++) {
-      Book->hash[index] = NIL;
-   }
+   table_init(book,hint);
 }
 
 // book_insert()
@@ -236,224 +428,215 @@ static void book_insert(const char file_name[], bool exact_match) {
 
    int game_nb;
    pgn_t pgn[1];
-   board_t board[1];
-   int ply;
-   char string[256];
-   int move;
-   int pos;
-   int player_elo;
-   int other_elo;
+   int size;
+   int i;
 
    ASSERT(file_name!=NULL);
 
-   // init
-
-   game_nb = 0;
-
    // scan loop
 
    pgn_open(pgn,file_name);
+   game_nb = ingest_shards(pgn,Threads,ShardNb,sizeof(record_t),game_records,list_apply,stderr);
+   pgn_close(pgn);
 
-   while (pgn_next_game(pgn)) {
-
-      board_start(board);
-      ply = 0;
-      player_elo = pgn->white_elo;
-      other_elo = pgn->black_elo;
-
-      while (pgn_next_move(pgn,string,256)) {
+   size = 0;
+   for (i = 0; i < ShardNb; i++) size += Shard[i].size;
 
-         if (ply < MaxPly) {
+   fprintf(stderr, "%d game%s.\n",game_nb,(game_nb>1)?"s":"");
+   fprintf(stderr, "%d entries.\n",size);
 
-            move = move_from_san(string,board);
+   return;
+}
 
-            if (move == MoveNone || !move_is_legal(move,board)) {
-              fprintf(stderr, "book_insert(): illegal move \"%s\" at line %d, column %d\n",string,pgn->move_line,pgn->move_column);
-               continue;
-            }
+// book_bloom()
 
-            pos = find_entry(board,move,true);
+static void book_bloom() {
 
-            if (player_elo > -1) {
-              Book->entry[pos].n++;
-              Book->entry[pos].gamenum = atoi(pgn->event);
-              Book->entry[pos].elo_sum += player_elo;
-              Book->entry[pos].elo_min = MIN(Book->entry[pos].elo_min, player_elo);
-              Book->entry[pos].elo_max = MAX(Book->entry[pos].elo_max, player_elo);
-              Book->entry[pos].elo_sumsq += (player_elo * player_elo);
-            }
-            
-            // swap player_elo and other_elo
-            int tmp_elo = player_elo;
-            player_elo = other_elo;
-            other_elo = tmp_elo;
-
-            if (Book->entry[pos].n >= COUNT_MAX) {
-               halve_stats(board->key);
-            }
+   int pos;
 
-            move_do(board,move);
-            ply++;
-         }
-      }
+   // built from the final table, whether learnt, loaded or merged
 
-      Book->entry[pos].terminal = 1;
+   bloom_init(Bloom,Book->size);
 
-      game_nb++;
-      if (game_nb % 10000 == 0) fprintf(stderr,"%d games ...\n",game_nb);
+   for (pos = 0; pos < Book->size; pos++) {
+      bloom_add(Bloom,Book->entry[pos].key,Book->entry[pos].move);
    }
-
-   pgn_close(pgn);
-
-   fprintf(stderr, "%d game%s.\n",game_nb,(game_nb>1)?"s":"");
-   fprintf(stderr, "%d entries.\n",Book->size);
-
-   return;
 }
 
+// game_records()
 
+static void game_records(pgn_t * pgn, record_list_t list[]) {
 
-// find_entry()
+   board_t board[1];
+   int ply;
+   char string[256];
+   int move;
+   int player_elo;
+   int other_elo;
+   int gamenum;
+   record_list_t * last;
 
-static int find_entry(const board_t * board, int move, bool create) {
+   ASSERT(pgn!=NULL);
+   ASSERT(list!=NULL);
 
-   uint64 key;
-   int index;
-   int pos;
+   board_start(board);
+   ply = 0;
+   player_elo = pgn->white_elo;
+   other_elo = pgn->black_elo;
+   gamenum = atoi(pgn->event);
+   last = NULL;
 
-   ASSERT(board!=NULL);
-   ASSERT(move_is_ok(move));
+   while (pgn_next_move(pgn,string,256)) {
 
-   ASSERT(move_is_legal(move,board));
+      if (ply < MaxPly) {
 
-   // init
+         move = move_from_san(string,board);
 
-   key = board->key;
+         if (move == MoveNone) { // move_from_san() only returns legal moves
+           fprintf(stderr, "book_insert(): illegal move \"%s\" at line %d, column %d\n",string,pgn->move_line,pgn->move_column);
+            continue;
+         }
 
-   // search
+         // keys are sharded on their high bits, the low bits index the hash table
 
-   for (index = key & Book->mask; (pos=Book->hash[index]) != NIL; index = (index+1) & Book->mask) {
+         last = &list[(board->key>>32)%ShardNb];
+         record_add(last,board,move,player_elo,gamenum);
 
-      ASSERT(pos>=0&&pos<Book->size);
+         // swap player_elo and other_elo
+         int tmp_elo = player_elo;
+         player_elo = other_elo;
+         other_elo = tmp_elo;
 
-      if (Book->entry[pos].key == key && Book->entry[pos].move == move) {
-         return pos; // found
+         move_do(board,move);
+         ply++;
       }
    }
 
-   if (!create) {
-     return -1;
-   }
+   if (last != NULL) ((record_t *) last->record)[last->size-1].terminal = 1;
+}
 
-   // not found
+// record_add()
 
-   ASSERT(Book->size<=Book->alloc);
+static void record_add(record_list_t * list, const board_t * board, int move, int elo, int gamenum) {
 
-   if (Book->size == Book->alloc) {
+   record_t * record;
 
-      // allocate more memory
+   ASSERT(list!=NULL);
+   ASSERT(board!=NULL);
+   ASSERT(move_is_ok(move));
 
-      resize();
+   record = (record_t *) record_new(list);
 
-      for (index = key & Book->mask; Book->hash[index] != NIL; index = (index+1) & Book->mask)
-         ;
-   }
+   record->key = board->key;
+   record->elo = elo;
+   record->move = move;
+   record->gamenum = gamenum;
+   record->terminal = 0;
+}
 
-   // create a new entry
+// list_apply()
 
-   ASSERT(Book->size<Book->alloc);
-   pos = Book->size++;
+static void list_apply(int shard, record_list_t * list) {
 
-   Book->entry[pos].key = key;
-   Book->entry[pos].move = move;
-   Book->entry[pos].n = 0;
-   Book->entry[pos].terminal = 0;
-   Book->entry[pos].elo_sum = 0;
-   Book->entry[pos].elo_sumsq = 0;
-   Book->entry[pos].elo_min = 4000;
-   Book->entry[pos].elo_max = 0;
+   book_t * book;
+   const record_t * record;
+   int i;
+   int pos;
+   int player_elo;
 
-   // insert into the hash table
+   ASSERT(shard>=0&&shard<ShardNb);
+   ASSERT(list!=NULL);
 
-   ASSERT(index>=0&&index<Book->alloc*2);
-   ASSERT(Book->hash[index]==NIL);
-   Book->hash[index] = pos;
+   book = &Shard[shard];
 
-   ASSERT(pos>=0&&pos<Book->size);
+   for (i = 0; i < list->size; i++) {
 
-   return pos;
-}
+      record = &((const record_t *) list->record)[i];
+      player_elo = record->elo;
 
-// resize()
+      pos = find_entry(book,record->key,record->move,true);
 
-static void resize() {
+      if (player_elo > -1) {
+        book->entry[pos].n++;
+        book->entry[pos].gamenum = record->gamenum;
+        book->entry[pos].elo_sum += player_elo;
+        book->entry[pos].elo_min = MIN(book->entry[pos].elo_min, player_elo);
+        book->entry[pos].elo_max = MAX(book->entry[pos].elo_max, player_elo);
+        book->entry[pos].elo_sumsq += uint64(player_elo) * player_elo;
+      }
 
-   int size;
-   int pos;
-   int index;
+      if (record->terminal) book->entry[pos].terminal = 1;
+   }
+}
 
-   ASSERT(Book->size==Book->alloc);
+// find_entry()
 
-   Book->alloc *= 2;
-   Book->mask = (Book->alloc * 2) - 1;
+static int find_entry(book_t * book, uint64 key, int move, bool create) {
 
-   size = 0;
-   size += Book->alloc * sizeof(entry_t);
-   size += (Book->alloc*2) * sizeof(sint32);
+   int pos;
 
-   if (size >= 1048576) fprintf(stderr,"allocating %gMB ...\n",double(size)/1048576.0);
+   ASSERT(book!=NULL);
+   ASSERT(move_is_ok(move));
 
-   // resize arrays
+   // search, lookups in the learnt table try the filter first
 
-   Book->entry = (entry_t *) my_realloc(Book->entry,Book->alloc*sizeof(entry_t));
-   Book->hash = (sint32 *) my_realloc(Book->hash,(Book->alloc*2)*sizeof(sint32));
+   if (!create && book == Book && Bloom->block != NULL && !bloom_has(Bloom,key,move)) return TableNone;
 
-   // rebuild hash table
+   pos = table_find(book,key,move);
+   if (pos != TableNone || !create) return pos;
 
-   for (index = 0; index < Book->alloc*2; index++) {
-      Book->hash[index] = NIL;
-   }
+   // create a new entry
 
-   for (pos = 0; pos < Book->size; pos++) {
+   pos = table_insert(book,key,move);
+   book->entry[pos].elo_min = 4000;
 
-      for (index = Book->entry[pos].key & Book->mask; Book->hash[index] != NIL; index = (index+1) & Book->mask)
-         ;
+   ASSERT(pos>=0&&pos<book->size);
 
-      ASSERT(index>=0&&index<Book->alloc*2);
-      Book->hash[index] = pos;
-   }
+   return pos;
 }
 
-// halve_stats()
+static void eloize_games(const char file_name[], bool exact_match) {
+
+   int game_nb;
+   pgn_t pgn[1];
 
-static void halve_stats(uint64 key) {
+   ASSERT(file_name!=NULL);
 
-   int index;
-   int pos;
+   pgn_open(pgn,file_name);
+
+   if (Threads > 1 && pgn->buf_mapped) {
+      eloize_parallel(pgn,exact_match);
+      pgn_close(pgn);
+      return;
+   }
 
-   // search
+   // init
 
-   for (index = key & Book->mask; (pos=Book->hash[index]) != NIL; index = (index+1) & Book->mask) {
+   game_nb = 0;
 
-      ASSERT(pos>=0&&pos<Book->size);
+   // scan loop
 
-      if (Book->entry[pos].key == key) {
-         Book->entry[pos].n = (Book->entry[pos].n + 1) / 2;
-         Book->entry[pos].elo_sum = (Book->entry[pos].elo_sum + 1) / 2;
-         Book->entry[pos].elo_sumsq = (Book->entry[pos].elo_sumsq + 1) / 2;
-      }
+   while (pgn_next_game(pgn)) {
+      eloize_game(pgn,exact_match,Out);
+      game_nb++;
+      if (game_nb % 10000 == 0) fprintf(stderr,"%d games ... (mode %i)\n",game_nb,exact_match);
    }
+   pgn_close(pgn);
+   fprintf(stderr, "ALL DONE.  %d games ...\n",game_nb);
 }
 
-static void eloize_games(const char file_name[], bool exact_match) {
-   int game_nb;
-   pgn_t pgn[1];
+// eloize_game()
+
+static void eloize_game(pgn_t * pgn, bool exact_match, out_t * out) {
+
    board_t board[1];
    int ply;
    char string[256];
    int move;
    int pos;
 
+   int field[FieldMax];
+
    struct elopath_stats final_stats;      // ELO stats for the last move # that had enough matches
    struct elopath_stats penultimate_stats; // ELO stats for the move before that
    
@@ -461,19 +644,12 @@ static void eloize_games(const char file_name[], bool exact_match) {
    int elo_max;   // looking at each move #, the largest of the average ELOs
    bool still_in_book;
 
-   ASSERT(file_name!=NULL);
-
-   // init
+   ASSERT(pgn!=NULL);
+   ASSERT(out!=NULL);
 
-   game_nb = 0;
-
-   // scan loop
-
-   pgn_open(pgn,file_name);
-
-   while (pgn_next_game(pgn)) {
       board_start(board);
       ply = 0;
+      pos = -1;
 
       final_stats.elo = -1;
       final_stats.ply = -1;
@@ -497,17 +673,17 @@ static void eloize_games(const char file_name[], bool exact_match) {
          if (ply < MaxPly) {
             move = move_from_san(string,board);
 
-            if (move == MoveNone || !move_is_legal(move,board)) {
+            if (move == MoveNone) { // move_from_san() only returns legal moves
               fprintf(stderr,"book_filter(): illegal move \"%s\" at line %d, column %d\n",string,pgn->move_line,pgn->move_column);
                continue;
             }
-            pos = find_entry(board,move,false);
+            pos = find_entry(Book,board->key,move,false);
             if (pos == -1 || (exact_match && Book->entry[pos].n == 0)) {
               still_in_book = false;
             }
             if (pos > -1 && ((exact_match && Book->entry[pos].n > 0)  || Book->entry[pos].n > 10)) {
               int avg_elo = Book->entry[pos].elo_sum / Book->entry[pos].n;
-              int stdev_elo = sqrt((Book->entry[pos].elo_sumsq / Book->entry[pos].n) - (avg_elo * avg_elo));
+              int stdev_elo = entry_stdev(&Book->entry[pos]);
 
               penultimate_stats = final_stats;
 
@@ -526,18 +702,566 @@ static void eloize_games(const char file_name[], bool exact_match) {
             ply++;
          }
       }
-      game_nb++;
-      if (game_nb % 10000 == 0) fprintf(stderr,"%d games ... (mode %i)\n",game_nb,exact_match);
       if (exact_match) {
-        if (still_in_book && (Book->entry[pos].terminal == 1) && (Book->entry[pos].n == 1)) {
-          printf("%s,%i\n", pgn->event, Book->entry[pos].gamenum);
+        if (still_in_book && pos != -1 && (Book->entry[pos].terminal == 1) && (Book->entry[pos].n == 1)) {
+          field[0] = Book->entry[pos].gamenum;
+          out_record(out, pgn->event, field, 1);
         }
       } else {
-        printf("%s,%i,%i,%i,%i,%i,%i,%i,%i,%i,%i,%i,%i,%i,%i\n", pgn->event, final_stats.elo, final_stats.ply, final_stats.num_games, final_stats.stdev_elo, elo_min, elo_max, final_stats.elo_min, final_stats.elo_max, penultimate_stats.elo, penultimate_stats.ply, penultimate_stats.num_games, penultimate_stats.stdev_elo, penultimate_stats.elo_min, penultimate_stats.elo_max);
+        field[0] = final_stats.elo;
+        field[1] = final_stats.ply;
+        field[2] = final_stats.num_games;
+        field[3] = final_stats.stdev_elo;
+        field[4] = elo_min;
+        field[5] = elo_max;
+        field[6] = final_stats.elo_min;
+        field[7] = final_stats.elo_max;
+        field[8] = penultimate_stats.elo;
+        field[9] = penultimate_stats.ply;
+        field[10] = penultimate_stats.num_games;
+        field[11] = penultimate_stats.stdev_elo;
+        field[12] = penultimate_stats.elo_min;
+        field[13] = penultimate_stats.elo_max;
+        out_record(out, pgn->event, field, 14);
+      }
+}
+
+// eloize_parallel()
+
+static void eloize_parallel(const pgn_t * pgn, bool exact_match) {
+
+   eloize_t eloize[1];
+   int window;
+   int i;
+
+   ASSERT(pgn!=NULL);
+   ASSERT(pgn->buf_mapped);
+
+   window = ingest_window(Threads);
+
+   eloize->exact_match = exact_match;
+   eloize->out = (out_t *) my_malloc(window*sizeof(out_t));
+   eloize->game_nb = 0;
+
+   for (i = 0; i < window; i++) out_init(&eloize->out[i],ChunkBufSize,false);
+
+   // score chunks in parallel against the read-only table, write them back in input order
+
+   ingest_map(pgn,Threads,eloize_map,eloize_write,eloize);
+
+   for (i = 0; i < window; i++) out_free(&eloize->out[i]);
+   my_free(eloize->out);
+
+   fprintf(stderr, "ALL DONE.  %d games ...\n",eloize->game_nb);
+}
+
+// eloize_map()
+
+static void eloize_map(pgn_t * pgn, int slot, void * data) {
+
+   eloize_t * eloize;
+
+   ASSERT(pgn!=NULL);
+   ASSERT(slot>=0);
+   ASSERT(data!=NULL);
+
+   eloize = (eloize_t *) data;
+
+   eloize_game(pgn,eloize->exact_match,&eloize->out[slot]);
+}
+
+// eloize_write()
+
+static void eloize_write(int slot, int game_nb, void * data) {
+
+   eloize_t * eloize;
+
+   ASSERT(slot>=0);
+   ASSERT(game_nb>=0);
+   ASSERT(data!=NULL);
+
+   eloize = (eloize_t *) data;
+
+   out_append(Out,&eloize->out[slot]);
+
+   if ((eloize->game_nb + game_nb) / 10000 != eloize->game_nb / 10000) {
+      fprintf(stderr,"%d games ... (mode %i)\n",eloize->game_nb+game_nb,eloize->exact_match);
+   }
+
+   eloize->game_nb += game_nb;
+
+   // the slot is reused for a later chunk
+
+   eloize->out[slot].size = 0;
+}
+
+// model_save()
+
+static void model_save(const char file_name[]) {
+
+   FILE * file;
+   char * tmp_name;
+   model_header_t header[1];
+   book_t model[1];
+
+   ASSERT(file_name!=NULL);
+
+   // entries sorted by key and move, followed by the index built over them
+
+   if (ModelData == NULL) { // a loaded model is sorted already, and read only
+      qsort(Book->entry,Book->size,sizeof(entry_t),&entry_compare);
+      table_rehash(Book);
+   }
+
+   // the smallest index that holds them, so that the file only depends on the entries
+
+   model->size = Book->size;
+   model->alloc = 1;
+   while (model->alloc < model->size) model->alloc *= 2;
+   model->mask = (model->alloc * 2) - 1;
+   model->entry = Book->entry;
+   model->slot = (uint64 *) my_malloc((model->alloc*2)*sizeof(uint64));
+   table_rehash(model);
+
+   memset(header,0,sizeof(model_header_t));
+   memcpy(header->magic,ModelMagic,8);
+   header->version = ModelVersion;
+   header->entry_size = sizeof(entry_t);
+   header->byte_order = ModelByteOrder;
+   header->size = model->size;
+   header->alloc = model->alloc;
+
+   // write a temporary file and rename it, the old model may still be mapped
+
+   tmp_name = (char *) my_malloc(strlen(file_name)+5);
+   sprintf(tmp_name,"%s.tmp",file_name);
+
+   file = fopen(tmp_name,"wb");
+   if (file == NULL) my_fatal("model_save(): can't open file \"%s\" for writing: %s\n",tmp_name,strerror(errno));
+
+   if (fwrite(header,sizeof(model_header_t),1,file) != 1
+    || fwrite(model->entry,sizeof(entry_t),model->size,file) != size_t(model->size)
+    || fwrite(model->slot,sizeof(uint64),model->alloc*2,file) != size_t(model->alloc*2)) {
+      my_fatal("model_save(): fwrite(): %s\n",strerror(errno));
+   }
+
+   if (fclose(file) == EOF) my_fatal("model_save(): fclose(): %s\n",strerror(errno));
+
+   if (rename(tmp_name,file_name) == -1) my_fatal("model_save(): rename(): %s\n",strerror(errno));
+
+   my_free(tmp_name);
+   my_free(model->slot);
+}
+
+// model_load()
+
+static void model_load(book_t * book, const char file_name[]) {
+
+   FILE * file;
+   const model_header_t * header;
+   void * address;
+   uint8 * data;
+
+   ASSERT(book!=NULL);
+   ASSERT(file_name!=NULL);
+   ASSERT(ModelData==NULL);
+
+   file = fopen(file_name,"rb");
+   if (file == NULL) my_fatal("model_load(): can't open file \"%s\": %s\n",file_name,strerror(errno));
+
+   if (fseek(file,0,SEEK_END) == -1) my_fatal("model_load(): fseek(): %s\n",strerror(errno));
+   ModelSize = ftell(file);
+
+   if (ModelSize < sint64(sizeof(model_header_t))) my_fatal("model_load(): \"%s\" is not a model file\n",file_name);
+
+   // lookups fault in the pages they touch, nothing is read up front
+
+   ModelData = NULL;
+   ModelMapped = false;
+
+   if (UseMmap) {
+
+      address = mmap(NULL,ModelSize,PROT_READ,MAP_SHARED,fileno(file),0);
+
+      if (address != MAP_FAILED) {
+         madvise(address,ModelSize,MADV_RANDOM);
+         ModelData = address;
+         ModelMapped = true;
+      }
+   }
+
+   if (!ModelMapped) {
+
+      data = (uint8 *) my_malloc(ModelSize);
+
+      if (fseek(file,0,SEEK_SET) == -1) my_fatal("model_load(): fseek(): %s\n",strerror(errno));
+      if (fread(data,1,ModelSize,file) != size_t(ModelSize)) my_fatal("model_load(): fread(): %s\n",strerror(errno));
+
+      ModelData = data;
+   }
+
+   fclose(file);
+
+   // check the header against this build
+
+   header = (const model_header_t *) ModelData;
+
+   if (memcmp(header->magic,ModelMagic,8) != 0) my_fatal("model_load(): \"%s\" is not a model file\n",file_name);
+   if (header->version != ModelVersion) my_fatal("model_load(): unsupported model version %u\n",header->version);
+
+   if (header->entry_size != sizeof(entry_t) || header->byte_order != ModelByteOrder) {
+      my_fatal("model_load(): \"%s\" was saved on an incompatible platform\n",file_name);
+   }
+
+   if (header->alloc < 1 || header->alloc > TableAllocMax || (header->alloc & (header->alloc - 1)) != 0
+    || header->size < 0 || header->size > header->alloc
+    || ModelSize != sint64(sizeof(model_header_t) + header->size * sizeof(entry_t) + header->alloc * 2 * sizeof(uint64))) {
+      my_fatal("model_load(): \"%s\" is corrupt\n",file_name);
+   }
+
+   // the table points into the file, read only
+
+   book->size = int(header->size);
+   book->alloc = int(header->alloc);
+   book->mask = (book->alloc * 2) - 1;
+   book->entry = (entry_t *) ((uint8 *) ModelData + sizeof(model_header_t));
+   book->slot = (uint64 *) ((uint8 *) ModelData + sizeof(model_header_t) + book->size * sizeof(entry_t));
+
+   fprintf(stderr, "%d entries.\n", book->size);
+}
+
+// model_close()
+
+static void model_close(book_t * book) {
+
+   ASSERT(book!=NULL);
+   ASSERT(ModelData!=NULL);
+
+   if (ModelMapped) {
+      munmap(ModelData,ModelSize);
+   } else {
+      my_free(ModelData);
+   }
+
+   ModelData = NULL;
+
+   book->entry = NULL;
+   book->slot = NULL;
+}
+
+// model_update()
+
+static void model_update(const char file_name[]) {
+
+   book_t old[1];
+   book_t merged[1];
+   entry_t * entry;
+   int i, j;
+   int diff;
+
+   ASSERT(file_name!=NULL);
+   ASSERT(ModelData==NULL);
+
+   // Book holds the new games only, merge it with the sorted model in one pass
+
+   model_load(old,file_name);
+
+   qsort(Book->entry,Book->size,sizeof(entry_t),&entry_compare);
+
+   table_init(merged,old->size+Book->size);
+
+   i = 0;
+   j = 0;
+
+   while (i < old->size || j < Book->size) {
+
+      if (i == old->size) {
+         diff = +1;
+      } else if (j == Book->size) {
+         diff = -1;
+      } else {
+         diff = entry_compare(&old->entry[i],&Book->entry[j]);
+      }
+
+      entry = &merged->entry[merged->size++];
+
+      if (diff < 0) {
+         *entry = old->entry[i++];
+      } else if (diff > 0) {
+         *entry = Book->entry[j++];
+      } else {
+         *entry = old->entry[i++];
+         entry_merge(entry,&Book->entry[j++]);
       }
    }
-   pgn_close(pgn);
-   fprintf(stderr, "ALL DONE.  %d games ...\n",game_nb);
+
+   table_rehash(merged);
+
+   model_close(old);
+   table_free(Book);
+
+   *Book = *merged;
+
+   fprintf(stderr, "%d entries.\n", Book->size);
+}
+
+// entry_merge()
+
+static void entry_merge(entry_t * dst, const entry_t * src) {
+
+   ASSERT(dst!=NULL);
+   ASSERT(src!=NULL);
+   ASSERT(dst->key==src->key&&dst->move==src->move);
+
+   // src comes from later games, same result as replaying them after dst
+
+   if (src->n != 0) dst->gamenum = src->gamenum;
+
+   dst->n += src->n;
+   dst->elo_sum += src->elo_sum;
+   dst->elo_sumsq += src->elo_sumsq;
+   dst->elo_min = MIN(dst->elo_min,src->elo_min);
+   dst->elo_max = MAX(dst->elo_max,src->elo_max);
+
+   if (src->terminal) dst->terminal = 1;
+}
+
+// entry_stdev()
+
+static int entry_stdev(const entry_t * entry) {
+
+   unsigned __int128 var;
+
+   ASSERT(entry!=NULL);
+   ASSERT(entry->n>0);
+
+   // n^2 * variance = n * sum(x^2) - sum(x)^2, exact and never negative;
+   // the old sum(x^2)/n - avg^2 in truncated integers was off by up to
+   // 2*avg (e.g. 44 instead of 0.5 for Elos 1999 and 2000)
+
+   var = (unsigned __int128) entry->n * entry->elo_sumsq - (unsigned __int128) entry->elo_sum * entry->elo_sum;
+
+   return int(sqrt(double(var)) / double(entry->n));
+}
+
+// entry_compare()
+
+static int entry_compare(const void * p1, const void * p2) {
+
+   const entry_t * entry_1, * entry_2;
+
+   ASSERT(p1!=NULL);
+   ASSERT(p2!=NULL);
+
+   entry_1 = (const entry_t *) p1;
+   entry_2 = (const entry_t *) p2;
+
+   if (entry_1->key != entry_2->key) return (entry_1->key < entry_2->key) ? -1 : +1;
+   if (entry_1->move != entry_2->move) return (entry_1->move < entry_2->move) ? -1 : +1;
+
+   return 0;
+}
+
+// out_open()
+
+static void out_open(bool exact_match) {
+
+   int i;
+
+   out_init(Out,OutBufSize,true);
+
+   if (OutBinary) {
+
+      // header: magic, number of 32-bit fields per record (game number included), reserved
+
+      out_reserve(Out,16);
+
+      for (i = 0; i < 8; i++) Out->buf[Out->size++] = OutMagic[i];
+
+      out_le32(Out,exact_match ? 2 : 15);
+      out_le32(Out,0);
+   }
+}
+
+// out_close()
+
+static void out_close() {
+
+   out_flush(Out);
+   out_free(Out);
+}
+
+// out_init()
+
+static void out_init(out_t * out, int alloc, bool flush) {
+
+   ASSERT(out!=NULL);
+   ASSERT(alloc>0);
+
+   out->buf = (char *) my_malloc(alloc);
+   out->size = 0;
+   out->alloc = alloc;
+   out->flush = flush;
+}
+
+// out_free()
+
+static void out_free(out_t * out) {
+
+   ASSERT(out!=NULL);
+
+   if (out->buf != NULL) my_free(out->buf);
+   out->buf = NULL;
+}
+
+// out_reserve()
+
+static void out_reserve(out_t * out, int size) {
+
+   ASSERT(out!=NULL);
+   ASSERT(size>=0);
+
+   if (out->size + size <= out->alloc) return;
+
+   if (out->flush) out_flush(out);
+
+   if (out->size + size > out->alloc) {
+      while (out->size + size > out->alloc) out->alloc *= 2;
+      out->buf = (char *) my_realloc(out->buf,out->alloc);
+   }
+}
+
+// out_flush()
+
+static void out_flush(out_t * out) {
+
+   ASSERT(out!=NULL);
+   ASSERT(out->flush);
+
+   if (out->size == 0) return;
+
+   if (fwrite(out->buf,1,out->size,stdout) != size_t(out->size)) {
+      my_fatal("out_flush(): fwrite(): %s\n",strerror(errno));
+   }
+
+   out->size = 0;
+}
+
+// out_append()
+
+static void out_append(out_t * out, const out_t * src) {
+
+   ASSERT(out!=NULL);
+   ASSERT(src!=NULL);
+
+   if (src->buf == NULL || src->size == 0) return;
+
+   if (out->flush && src->size > out->alloc - out->size) {
+
+      // large chunk, write it straight through
+
+      out_flush(out);
+
+      if (fwrite(src->buf,1,src->size,stdout) != size_t(src->size)) {
+         my_fatal("out_append(): fwrite(): %s\n",strerror(errno));
+      }
+
+      return;
+   }
+
+   out_reserve(out,src->size);
+
+   memcpy(&out->buf[out->size],src->buf,src->size);
+   out->size += src->size;
+}
+
+// out_record()
+
+static void out_record(out_t * out, const char event[], const int field[], int field_nb) {
+
+   int i;
+
+   ASSERT(out!=NULL);
+   ASSERT(event!=NULL);
+   ASSERT(field!=NULL);
+   ASSERT(field_nb>=0&&field_nb<FieldMax);
+
+   out_reserve(out,16*(field_nb+1)+int(strlen(event)));
+
+   if (OutBinary) {
+
+      // fixed-width little-endian record, the event is the game number
+
+      out_le32(out,atoi(event));
+      for (i = 0; i < field_nb; i++) out_le32(out,field[i]);
+
+   } else {
+
+      out_string(out,event);
+
+      for (i = 0; i < field_nb; i++) {
+         out->buf[out->size++] = ',';
+         out_int(out,field[i]);
+      }
+
+      out->buf[out->size++] = '\n';
+   }
+}
+
+// out_string()
+
+static void out_string(out_t * out, const char string[]) {
+
+   int size;
+
+   ASSERT(out!=NULL);
+   ASSERT(string!=NULL);
+
+   size = int(strlen(string));
+
+   out_reserve(out,size);
+
+   memcpy(&out->buf[out->size],string,size);
+   out->size += size;
+}
+
+// out_int()
+
+static void out_int(out_t * out, int n) {
+
+   char digit[16];
+   uint32 u;
+   int size;
+
+   ASSERT(out!=NULL);
+
+   // same text as printf("%i"), the caller reserved room
+
+   u = (n < 0) ? 0 - uint32(n) : uint32(n);
+
+   size = 0;
+
+   do {
+      digit[size++] = '0' + u % 10;
+      u /= 10;
+   } while (u != 0);
+
+   if (n < 0) out->buf[out->size++] = '-';
+   while (size > 0) out->buf[out->size++] = digit[--size];
+}
+
+// out_le32()
+
+static void out_le32(out_t * out, uint32 n) {
+
+   ASSERT(out!=NULL);
+
+   // the caller reserved room
+
+   out->buf[out->size++] = char(n);
+   out->buf[out->size++] = char(n >> 8);
+   out->buf[out->size++] = char(n >> 16);
+   out->buf[out->size++] = char(n >> 24);
 }
 
 
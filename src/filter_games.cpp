@@ -9,40 +9,62 @@
 #include <cstdlib>
 #include <cstring>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <dirent.h>
 #include <unistd.h>
 
+#include "bloom.h"
 #include "board.h"
 #include "filter_games.h"
+#include "ingest.h"
 #include "move.h"
 #include "move_do.h"
 #include "move_legal.h"
 #include "pgn.h"
 #include "san.h"
+#include "table.h"
+#include "thread.h"
 #include "util.h"
 
 // constants
 
-static const int COUNT_MAX = 16384;
-
-static const int NIL = -1;
+static const int IovSize = 1024; // even, <= IOV_MAX
 
 // types
 
 struct entry_t {
    uint64 key;
+   uint64 n;
    uint16 move;
-   uint16 n;
-  uint16 terminal;
-   uint16 colour;
+   uint8 colour;
+   uint8 terminal;
 };
 
-struct book_t {
-   int size;
-   int alloc;
-   uint32 mask;
-   entry_t * entry;
-   sint32 * hash;
+typedef table_t<entry_t> book_t;
+
+struct record_t {
+   uint64 key;
+   uint16 move;
+   uint8 colour;
+   uint8 terminal;
+};
+
+struct slice_t {
+   const char * string;
+   sint64 size;
+};
+
+struct chunk_t {
+   int num_OK;
+   int slice_nb;
+   int slice_alloc;
+   slice_t * slice;
+};
+
+struct filter_t {
+   chunk_t * chunk; // per window slot
+   int game_nb;
+   int num_OK;
 };
 
 // variables
@@ -52,19 +74,39 @@ static int MinGame;
 static double MinScore;
 static bool RemoveWhite, RemoveBlack;
 static bool Uniform;
+static int Threads;
+static sint64 ExpectedPositions;
+static bool BloomFilter;
 
 static book_t Book[1];
+static bloom_t Bloom[1];
+
+static int ShardNb;
+static book_t Shard[ThreadMax];
 
 // prototypes
 
-static void   book_clear    ();
+static void   book_clear    (book_t * book, int hint);
 static void   book_insert   (const char file_name[]);
+static void   book_bloom    ();
 static void   book_filter   (const char file_name[]);
 
-static int    find_entry    (const board_t * board, int move, bool create);
-static void   resize        ();
-static void   halve_stats   (uint64 key);
+static int    find_entry    (book_t * book, uint64 key, int move, int colour, bool create);
+
+static void   game_records  (pgn_t * pgn, record_list_t list[]);
+static void   record_add    (record_list_t * list, const board_t * board, int move);
+static void   list_apply    (int shard, record_list_t * list);
+
+static bool   game_is_forbidden (pgn_t * pgn);
+
+static void   filter_parallel (const pgn_t * pgn);
+static void   filter_game   (pgn_t * pgn, int slot, void * data);
+static void   filter_write  (int slot, int game_nb, void * data);
+static void   chunk_add     (chunk_t * chunk, const pgn_t * pgn);
 
+static void   write_game    (const pgn_t * pgn);
+static void   write_chunk   (const chunk_t * chunk);
+static void   write_iov     (struct iovec iov[], int iov_nb);
 
 
 // functions
@@ -74,6 +116,7 @@ static void   halve_stats   (uint64 key);
 void filter_games(int argc, char * argv[]) {
 
    int i;
+   int hint;
    const char * forbidden_pgn_files[100];
    int num_forbidden_files = 0;
    const char * input_pgn_files[100];
@@ -90,6 +133,9 @@ void filter_games(int argc, char * argv[]) {
    }
 
    MaxPly = 1024;
+   Threads = 1;
+   ExpectedPositions = 0;
+   BloomFilter = false;
 
    for (i = 1; i < argc; i++) {
 
@@ -113,13 +159,48 @@ void filter_games(int argc, char * argv[]) {
 
          my_string_set(&input_pgn_files[num_input_files++],argv[i]);
 
+      } else if (my_string_equal(argv[i],"-expected-positions")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("filter_games(): missing argument\n");
+
+         ExpectedPositions = my_atoll(argv[i]);
+         if (ExpectedPositions < 0) my_fatal("filter_games(): invalid number of positions\n");
+
+      } else if (my_string_equal(argv[i],"-bloom")) {
+
+         BloomFilter = true;
+
+      } else if (my_string_equal(argv[i],"-threads")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("filter_games(): missing argument\n");
+
+         Threads = atoi(argv[i]);
+         if (Threads <= 0) Threads = thread_nb_default();
+         if (Threads > ThreadMax) Threads = ThreadMax;
+
       } else {
 
          my_fatal("filter_games(): unknown option \"%s\"\n",argv[i]);
       }
    }
 
-   book_clear();
+   ShardNb = Threads;
+
+   // size the shards for the whole input, keys spread evenly over them
+
+   if (ExpectedPositions == 0) {
+      for (i = 0; i < num_forbidden_files; i++) {
+         ExpectedPositions += table_estimate(my_file_size(forbidden_pgn_files[i]),MaxPly);
+      }
+   }
+
+   hint = (ExpectedPositions / ShardNb > TableAllocMax) ? TableAllocMax : int(ExpectedPositions / ShardNb + 1);
+
+   for (i = 0; i < ShardNb; i++) {
+      book_clear(&Shard[i],hint);
+   }
 
    fprintf(stderr, "hi!\n");
 
@@ -128,6 +209,10 @@ void filter_games(int argc, char * argv[]) {
      book_insert(forbidden_pgn_files[i]);
    }
 
+   table_join(Book,Shard,ShardNb);
+
+   if (BloomFilter) book_bloom();
+
    for (i=0; i<num_input_files; i++) {
      stat(input_pgn_files[i], &buf);
      if (buf.st_mode & S_IFDIR) {
@@ -152,25 +237,19 @@ void filter_games(int argc, char * argv[]) {
 
    }
 
+   if (BloomFilter) bloom_free(Bloom);
+
    fputs("all done!\n", stderr);
 }
 
 // book_clear()
 
-static void book_clear() {
-
-   int index;
-
-   Book->alloc = 1;
-   Book->mask = (Book->alloc * 2) - 1;
+static void book_clear(book_t * book, int hint) {
 
-   Book->entry = (entry_t *) my_malloc(Book->alloc*sizeof(entry_t));
-   Book->size = 0;
+   ASSERT(book!=NULL);
+   ASSERT(hint>=0);
 
-   Book->hash = (sint32 *) my_malloc((Book->alloc*2)*sizeof(sint32));
-   for (index = 0; index < Book->alloc*2; index++) {
-      Book->hash[index] = NIL;
-   }
+   table_init(book,hint);
 }
 
 // book_insert()
@@ -179,251 +258,421 @@ static void book_insert(const char file_name[]) {
 
    int game_nb;
    pgn_t pgn[1];
-   board_t board[1];
-   int ply;
-   char string[256];
-   int move;
-   int pos;
+   int size;
+   int i;
 
    ASSERT(file_name!=NULL);
 
-   // init
-
-   game_nb = 0;
-
    // scan loop
 
    pgn_open(pgn,file_name);
+   game_nb = ingest_shards(pgn,Threads,ShardNb,sizeof(record_t),game_records,list_apply,stderr);
+   pgn_close(pgn);
 
-   while (pgn_next_game(pgn)) {
+   size = 0;
+   for (i = 0; i < ShardNb; i++) size += Shard[i].size;
+
+   fprintf(stderr, "%d game%s.\n",game_nb,(game_nb>1)?"s":"");
+   fprintf(stderr, "%d entries.\n",size);
+
+   return;
+}
 
-      board_start(board);
-      ply = 0;
+// book_bloom()
 
-      while (pgn_next_move(pgn,string,256)) {
+static void book_bloom() {
 
-         if (ply < MaxPly) {
+   int pos;
 
-            move = move_from_san(string,board);
+   // most lookups miss once a game leaves the forbidden set
 
-            if (move == MoveNone || !move_is_legal(move,board)) {
-              fprintf(stderr, "book_insert(): illegal move \"%s\" at line %d, column %d\n",string,pgn->move_line,pgn->move_column);
-               continue;
-            }
+   bloom_init(Bloom,Book->size);
 
-            pos = find_entry(board,move,true);
+   for (pos = 0; pos < Book->size; pos++) {
+      bloom_add(Bloom,Book->entry[pos].key,Book->entry[pos].move);
+   }
+}
 
-            Book->entry[pos].n++;
+// game_records()
 
-            if (Book->entry[pos].n >= COUNT_MAX) {
-               halve_stats(board->key);
-            }
+static void game_records(pgn_t * pgn, record_list_t list[]) {
 
-            move_do(board,move);
-            ply++;
+   board_t board[1];
+   int ply;
+   char string[256];
+   int move;
+   record_list_t * last;
+
+   ASSERT(pgn!=NULL);
+   ASSERT(list!=NULL);
+
+   board_start(board);
+   ply = 0;
+   last = NULL;
+
+   while (pgn_next_move(pgn,string,256)) {
+
+      if (ply < MaxPly) {
+
+         move = move_from_san(string,board);
+
+         if (move == MoveNone) { // move_from_san() only returns legal moves
+           fprintf(stderr, "book_insert(): illegal move \"%s\" at line %d, column %d\n",string,pgn->move_line,pgn->move_column);
+            continue;
          }
-      }
 
-      Book->entry[pos].terminal = 1;
+         // keys are sharded on their high bits, the low bits index the hash table
 
-      game_nb++;
-      if (game_nb % 10000 == 0) fprintf(stderr,"%d games ...\n",game_nb);
+         last = &list[(board->key>>32)%ShardNb];
+         record_add(last,board,move);
+
+         move_do(board,move);
+         ply++;
+      }
    }
 
-   pgn_close(pgn);
+   if (last != NULL) ((record_t *) last->record)[last->size-1].terminal = 1;
+}
 
-   fprintf(stderr, "%d game%s.\n",game_nb,(game_nb>1)?"s":"");
-   fprintf(stderr, "%d entries.\n",Book->size);
+// record_add()
 
-   return;
+static void record_add(record_list_t * list, const board_t * board, int move) {
+
+   record_t * record;
+
+   ASSERT(list!=NULL);
+   ASSERT(board!=NULL);
+   ASSERT(move_is_ok(move));
+
+   record = (record_t *) record_new(list);
+
+   record->key = board->key;
+   record->move = move;
+   record->colour = board->turn;
+   record->terminal = 0;
 }
 
+// list_apply()
+
+static void list_apply(int shard, record_list_t * list) {
+
+   book_t * book;
+   const record_t * record;
+   int i;
+   int pos;
+
+   ASSERT(shard>=0&&shard<ShardNb);
+   ASSERT(list!=NULL);
+
+   book = &Shard[shard];
 
+   for (i = 0; i < list->size; i++) {
+
+      record = &((const record_t *) list->record)[i];
+
+      pos = find_entry(book,record->key,record->move,record->colour,true);
+
+      book->entry[pos].n++;
+
+      if (record->terminal) book->entry[pos].terminal = 1;
+   }
+}
 
 // find_entry()
 
-static int find_entry(const board_t * board, int move, bool create) {
+static int find_entry(book_t * book, uint64 key, int move, int colour, bool create) {
 
-   uint64 key;
-   int index;
    int pos;
 
-   ASSERT(board!=NULL);
+   ASSERT(book!=NULL);
    ASSERT(move_is_ok(move));
+   ASSERT(colour_is_ok(colour));
 
-   ASSERT(move_is_legal(move,board));
+   // search, lookups in the learnt table try the filter first
 
-   // init
+   if (!create && book == Book && Bloom->block != NULL && !bloom_has(Bloom,key,move)) return TableNone;
 
-   key = board->key;
+   pos = table_find(book,key,move);
+   if (pos != TableNone || !create) return pos;
 
-   // search
+   // create a new entry
 
-   for (index = key & Book->mask; (pos=Book->hash[index]) != NIL; index = (index+1) & Book->mask) {
+   pos = table_insert(book,key,move);
+   book->entry[pos].colour = colour;
 
-      ASSERT(pos>=0&&pos<Book->size);
+   ASSERT(pos>=0&&pos<book->size);
 
-      if (Book->entry[pos].key == key && Book->entry[pos].move == move) {
-         return pos; // found
-      }
+   return pos;
+}
+
+// book_filter()
+
+static void book_filter(const char file_name[]) {
+
+   pgn_t pgn[1];
+   int game_nb;
+   int num_OK;
+
+   ASSERT(file_name!=NULL);
+
+   pgn_open(pgn,file_name);
+
+   if (Threads > 1 && pgn->buf_mapped) {
+      filter_parallel(pgn);
+      pgn_close(pgn);
+      return;
    }
 
-   if (!create) {
-     return -1;
+   // init
+
+   game_nb = 0;
+   num_OK = 0;
+
+   // scan loop
+
+   while (pgn_next_game(pgn)) {
+      if (!game_is_forbidden(pgn)) {
+        num_OK++;
+        write_game(pgn);
+      }
+      game_nb++;
+      if (game_nb % 10000 == 0) fprintf(stderr,"%d games, %d OK ...\n",game_nb,num_OK);
    }
+   pgn_close(pgn);
+   fprintf(stderr, "ALL DONE.  %d games, %d OK ...\n",game_nb,num_OK);
+}
 
-   // not found
+// game_is_forbidden()
 
-   ASSERT(Book->size<=Book->alloc);
+static bool game_is_forbidden(pgn_t * pgn) {
 
-   if (Book->size == Book->alloc) {
+   board_t board[1];
+   int ply;
+   char string[256];
+   int move;
+   int pos;
+   bool still_in_book;
+
+   ASSERT(pgn!=NULL);
 
-      // allocate more memory
+   board_start(board);
+   ply = 0;
+   pos = -1;
 
-      resize();
+   still_in_book = true;
+   while (pgn_next_move(pgn,string,256)) {
+      if (ply < MaxPly) {
+         move = move_from_san(string,board);
 
-      for (index = key & Book->mask; Book->hash[index] != NIL; index = (index+1) & Book->mask)
-         ;
+         if (move == MoveNone) { // move_from_san() only returns legal moves
+           fprintf(stderr,"book_filter(): illegal move \"%s\" at line %d, column %d\n",string,pgn->move_line,pgn->move_column);
+            continue;
+         }
+         pos = find_entry(Book,board->key,move,board->turn,false);
+         if (pos == -1) {
+           still_in_book = false;
+         }
+         move_do(board,move);
+         ply++;
+      }
    }
 
-   // create a new entry
+   return still_in_book && pos != -1 && (Book->entry[pos].terminal == 1);
+}
 
-   ASSERT(Book->size<Book->alloc);
-   pos = Book->size++;
+// filter_parallel()
 
-   Book->entry[pos].key = key;
-   Book->entry[pos].move = move;
-   Book->entry[pos].n = 0;
-   Book->entry[pos].terminal = 0;
-   Book->entry[pos].colour = board->turn;
+static void filter_parallel(const pgn_t * pgn) {
 
-   // insert into the hash table
+   filter_t filter[1];
+   chunk_t * chunk;
+   int window;
+   int i;
 
-   ASSERT(index>=0&&index<Book->alloc*2);
-   ASSERT(Book->hash[index]==NIL);
-   Book->hash[index] = pos;
+   ASSERT(pgn!=NULL);
+   ASSERT(pgn->buf_mapped);
 
-   ASSERT(pos>=0&&pos<Book->size);
+   window = ingest_window(Threads);
 
-   return pos;
+   filter->chunk = (chunk_t *) my_malloc(window*sizeof(chunk_t));
+   filter->game_nb = 0;
+   filter->num_OK = 0;
+
+   for (i = 0; i < window; i++) {
+      chunk = &filter->chunk[i];
+      chunk->num_OK = 0;
+      chunk->slice_nb = 0;
+      chunk->slice_alloc = 0;
+      chunk->slice = NULL;
+   }
+
+   // filter chunks in parallel, write them back in input order
+
+   ingest_map(pgn,Threads,filter_game,filter_write,filter);
+
+   for (i = 0; i < window; i++) {
+      if (filter->chunk[i].slice != NULL) my_free(filter->chunk[i].slice);
+   }
+
+   my_free(filter->chunk);
+
+   fprintf(stderr, "ALL DONE.  %d games, %d OK ...\n",filter->game_nb,filter->num_OK);
 }
 
-// resize()
+// filter_game()
 
-static void resize() {
+static void filter_game(pgn_t * pgn, int slot, void * data) {
 
-   int size;
-   int pos;
-   int index;
+   chunk_t * chunk;
 
-   ASSERT(Book->size==Book->alloc);
+   ASSERT(pgn!=NULL);
+   ASSERT(slot>=0);
+   ASSERT(data!=NULL);
 
-   Book->alloc *= 2;
-   Book->mask = (Book->alloc * 2) - 1;
+   chunk = &((filter_t *) data)->chunk[slot];
 
-   size = 0;
-   size += Book->alloc * sizeof(entry_t);
-   size += (Book->alloc*2) * sizeof(sint32);
+   if (!game_is_forbidden(pgn)) {
+      chunk->num_OK++;
+      chunk_add(chunk,pgn);
+   }
+}
 
-   if (size >= 1048576) fprintf(stderr,"allocating %gMB ...\n",double(size)/1048576.0);
+// filter_write()
 
-   // resize arrays
+static void filter_write(int slot, int game_nb, void * data) {
 
-   Book->entry = (entry_t *) my_realloc(Book->entry,Book->alloc*sizeof(entry_t));
-   Book->hash = (sint32 *) my_realloc(Book->hash,(Book->alloc*2)*sizeof(sint32));
+   filter_t * filter;
+   chunk_t * chunk;
 
-   // rebuild hash table
+   ASSERT(slot>=0);
+   ASSERT(game_nb>=0);
+   ASSERT(data!=NULL);
 
-   for (index = 0; index < Book->alloc*2; index++) {
-      Book->hash[index] = NIL;
+   filter = (filter_t *) data;
+   chunk = &filter->chunk[slot];
+
+   write_chunk(chunk);
+
+   if ((filter->game_nb + game_nb) / 10000 != filter->game_nb / 10000) {
+      fprintf(stderr,"%d games, %d OK ...\n",filter->game_nb+game_nb,filter->num_OK+chunk->num_OK);
    }
 
-   for (pos = 0; pos < Book->size; pos++) {
+   filter->game_nb += game_nb;
+   filter->num_OK += chunk->num_OK;
+
+   // the slot is reused for a later chunk
+
+   chunk->num_OK = 0;
+   chunk->slice_nb = 0;
+}
+
+// chunk_add()
 
-      for (index = Book->entry[pos].key & Book->mask; Book->hash[index] != NIL; index = (index+1) & Book->mask)
-         ;
+static void chunk_add(chunk_t * chunk, const pgn_t * pgn) {
 
-      ASSERT(index>=0&&index<Book->alloc*2);
-      Book->hash[index] = pos;
+   slice_t * slice;
+
+   ASSERT(chunk!=NULL);
+   ASSERT(pgn!=NULL);
+
+   if (chunk->slice_nb == chunk->slice_alloc) {
+      chunk->slice_alloc = (chunk->slice_alloc == 0) ? 256 : chunk->slice_alloc * 2;
+      if (chunk->slice == NULL) {
+         chunk->slice = (slice_t *) my_malloc(chunk->slice_alloc*sizeof(slice_t));
+      } else {
+         chunk->slice = (slice_t *) my_realloc(chunk->slice,chunk->slice_alloc*sizeof(slice_t));
+      }
    }
+
+   slice = &chunk->slice[chunk->slice_nb++];
+   pgn_game(pgn,&slice->string,&slice->size);
 }
 
-// halve_stats()
+// write_game()
 
-static void halve_stats(uint64 key) {
+static void write_game(const pgn_t * pgn) {
 
-   int index;
-   int pos;
+   const char * string;
+   sint64 size;
+   struct iovec iov[2];
+
+   ASSERT(pgn!=NULL);
 
-   // search
+   // original bytes of the game plus a separating newline, no copy
 
-   for (index = key & Book->mask; (pos=Book->hash[index]) != NIL; index = (index+1) & Book->mask) {
+   pgn_game(pgn,&string,&size);
 
-      ASSERT(pos>=0&&pos<Book->size);
+   iov[0].iov_base = (void *) string;
+   iov[0].iov_len = size;
+   iov[1].iov_base = (void *) "\n";
+   iov[1].iov_len = 1;
 
-      if (Book->entry[pos].key == key) {
-         Book->entry[pos].n = (Book->entry[pos].n + 1) / 2;
+   write_iov(iov,2);
+}
+
+// write_chunk()
+
+static void write_chunk(const chunk_t * chunk) {
+
+   struct iovec iov[IovSize];
+   int iov_nb;
+   int i;
+
+   ASSERT(chunk!=NULL);
+
+   iov_nb = 0;
+
+   for (i = 0; i < chunk->slice_nb; i++) {
+
+      if (iov_nb == IovSize) {
+         write_iov(iov,iov_nb);
+         iov_nb = 0;
       }
+
+      iov[iov_nb].iov_base = (void *) chunk->slice[i].string;
+      iov[iov_nb].iov_len = chunk->slice[i].size;
+      iov_nb++;
+
+      iov[iov_nb].iov_base = (void *) "\n";
+      iov[iov_nb].iov_len = 1;
+      iov_nb++;
    }
+
+   if (iov_nb > 0) write_iov(iov,iov_nb);
 }
 
+// write_iov()
 
-static void book_filter(const char file_name[]) {
-   int game_nb;
-   pgn_t pgn[1];
-   board_t board[1];
-   int ply;
-   char string[256];
-   int move;
-   int pos;
-   int num_OK;
-   bool still_in_book;
+static void write_iov(struct iovec iov[], int iov_nb) {
 
-   ASSERT(file_name!=NULL);
+   ssize_t n;
 
-   // init
+   ASSERT(iov!=NULL);
+   ASSERT(iov_nb>0);
 
-   game_nb = 0;
-   num_OK = 0;
+   while (iov_nb > 0) {
 
-   // scan loop
+      n = writev(STDOUT_FILENO,iov,iov_nb);
 
-   pgn_open(pgn,file_name);
+      if (n == -1) {
+         if (errno == EINTR) continue;
+         my_fatal("write_iov(): writev(): %s\n",strerror(errno));
+      }
 
-   while (pgn_next_game(pgn)) {
-      board_start(board);
-      ply = 0;
-
-      still_in_book = true;
-      while (pgn_next_move(pgn,string,256)) {
-         if (ply < MaxPly) {
-            move = move_from_san(string,board);
-
-            if (move == MoveNone || !move_is_legal(move,board)) {
-              fprintf(stderr,"book_filter(): illegal move \"%s\" at line %d, column %d\n",string,pgn->move_line,pgn->move_column);
-               continue;
-            }
-            pos = find_entry(board,move,false);
-            if (pos == -1) {
-              still_in_book = false;
-            }
-            move_do(board,move);
-            ply++;
-         }
+      // partial write
+
+      while (iov_nb > 0 && size_t(n) >= iov->iov_len) {
+         n -= iov->iov_len;
+         iov++;
+         iov_nb--;
       }
-      if (still_in_book && (Book->entry[pos].terminal == 1)) {
-        // this is a FORBIDDEN GAME
-      } else {
-        num_OK++;
-        printf("%s\n",(char *)(pgn->game_string));
+
+      if (iov_nb > 0) {
+         iov->iov_base = (char *) iov->iov_base + n;
+         iov->iov_len -= n;
       }
-      game_nb++;
-      if (game_nb % 10000 == 0) fprintf(stderr,"%d games, %d OK ...\n",game_nb,num_OK);
    }
-   pgn_close(pgn);
-   fprintf(stderr, "ALL DONE.  %d games, %d OK ...\n",game_nb,num_OK);
 }
 
-
 // end of filter_games.cpp
 
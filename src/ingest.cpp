@@ -0,0 +1,377 @@
+
+// ingest.cpp
+
+// includes
+
+#include <cstdio>
+
+#include "ingest.h"
+#include "pgn.h"
+#include "thread.h"
+#include "util.h"
+
+// types
+
+struct batch_t {
+   pgn_chunk_t pgn;
+   int game_nb;
+   record_list_t list[ThreadMax]; // one per shard
+};
+
+struct shards_t {
+   const pgn_t * pgn;
+   ingest_game_t game;
+   ingest_apply_t apply;
+   batch_t * batch;
+   int batch_nb;
+   volatile int next;
+};
+
+struct map_t {
+   const pgn_t * pgn;
+   ingest_map_t map;
+   void * data;
+   pgn_chunk_t * chunk;
+   int * game_nb; // per chunk
+   int chunk_nb;
+   int window;
+   volatile int next;
+   thread_seq_t seq[1];
+};
+
+// prototypes
+
+static int  ingest_split    (const pgn_t * pgn, int thread_nb, pgn_chunk_t * * chunk);
+
+static int  shards_parallel (const pgn_t * pgn, int thread_nb, int shard_nb, int record_size, ingest_game_t game, ingest_apply_t apply, FILE * log);
+static void parse_thread    (int, void * data);
+static void apply_thread    (int id, void * data);
+
+static void map_thread      (int, void * data);
+
+// functions
+
+// record_list_init()
+
+void record_list_init(record_list_t * list, int record_size) {
+
+   ASSERT(list!=NULL);
+   ASSERT(record_size>0);
+
+   list->size = 0;
+   list->alloc = 0;
+   list->record_size = record_size;
+   list->record = NULL;
+}
+
+// record_list_free()
+
+void record_list_free(record_list_t * list) {
+
+   ASSERT(list!=NULL);
+
+   if (list->record != NULL) my_free(list->record);
+
+   list->record = NULL;
+   list->size = 0;
+   list->alloc = 0;
+}
+
+// record_new()
+
+void * record_new(record_list_t * list) {
+
+   ASSERT(list!=NULL);
+
+   if (list->size == list->alloc) {
+      list->alloc = (list->alloc == 0) ? 1024 : list->alloc * 2;
+      if (list->record == NULL) {
+         list->record = (char *) my_malloc(list->alloc*list->record_size);
+      } else {
+         list->record = (char *) my_realloc(list->record,list->alloc*list->record_size);
+      }
+   }
+
+   return &list->record[(list->size++)*list->record_size];
+}
+
+// ingest_shards()
+
+int ingest_shards(pgn_t * pgn, int thread_nb, int shard_nb, int record_size, ingest_game_t game, ingest_apply_t apply, FILE * log) {
+
+   record_list_t list[ThreadMax];
+   int game_nb;
+   int i;
+
+   ASSERT(pgn!=NULL);
+   ASSERT(thread_nb>=1&&thread_nb<=ThreadMax);
+   ASSERT(shard_nb>=1&&shard_nb<=ThreadMax);
+   ASSERT(record_size>0);
+   ASSERT(game!=NULL);
+   ASSERT(apply!=NULL);
+   ASSERT(log!=NULL);
+
+   if (thread_nb > 1 && pgn->buf_mapped) {
+      return shards_parallel(pgn,thread_nb,shard_nb,record_size,game,apply,log);
+   }
+
+   // one game at a time, pipes etc. cannot be cut into chunks
+
+   game_nb = 0;
+
+   for (i = 0; i < shard_nb; i++) record_list_init(&list[i],record_size);
+
+   while (pgn_next_game(pgn)) {
+
+      game(pgn,list);
+
+      for (i = 0; i < shard_nb; i++) {
+         apply(i,&list[i]);
+         list[i].size = 0;
+      }
+
+      game_nb++;
+      if (game_nb % 10000 == 0) fprintf(log,"%d games ...\n",game_nb);
+   }
+
+   for (i = 0; i < shard_nb; i++) record_list_free(&list[i]);
+
+   return game_nb;
+}
+
+// ingest_window()
+
+int ingest_window(int thread_nb) {
+
+   ASSERT(thread_nb>=1&&thread_nb<=ThreadMax);
+
+   // chunks in flight, enough to keep the threads busy
+
+   return thread_nb * 2;
+}
+
+// ingest_map()
+
+void ingest_map(const pgn_t * pgn, int thread_nb, ingest_map_t map, ingest_write_t write, void * data) {
+
+   map_t ctx[1];
+   thread_pool_t pool[1];
+   int i;
+
+   ASSERT(pgn!=NULL);
+   ASSERT(pgn->buf_mapped);
+   ASSERT(thread_nb>=1&&thread_nb<=ThreadMax);
+   ASSERT(map!=NULL);
+   ASSERT(write!=NULL);
+
+   ctx->pgn = pgn;
+   ctx->map = map;
+   ctx->data = data;
+   ctx->chunk_nb = ingest_split(pgn,thread_nb,&ctx->chunk);
+   ctx->game_nb = (int *) my_malloc((ctx->chunk_nb+1)*sizeof(int));
+   ctx->window = ingest_window(thread_nb);
+   ctx->next = 0;
+
+   thread_seq_init(ctx->seq,ctx->chunk_nb,ctx->window);
+
+   // map chunks in parallel, hand them back in input order; workers stay
+   // within a window of chunks ahead of the writer, so that the buffered
+   // results do not grow with the input
+
+   thread_start(pool,thread_nb,map_thread,ctx);
+
+   for (i = 0; i < ctx->chunk_nb; i++) {
+      thread_seq_wait(ctx->seq,i);
+      write(i%ctx->window,ctx->game_nb[i],data);
+      thread_seq_leave(ctx->seq,i);
+   }
+
+   thread_join(pool);
+
+   thread_seq_free(ctx->seq);
+
+   my_free(ctx->game_nb);
+   my_free(ctx->chunk);
+}
+
+// ingest_split()
+
+static int ingest_split(const pgn_t * pgn, int thread_nb, pgn_chunk_t * * chunk) {
+
+   sint64 chunk_size;
+   int chunk_max;
+
+   ASSERT(pgn!=NULL);
+   ASSERT(pgn->buf_mapped);
+   ASSERT(thread_nb>=1);
+   ASSERT(chunk!=NULL);
+
+   // cut the input at game boundaries, in enough chunks to balance the threads
+
+   chunk_size = pgn->buf_size / (thread_nb * 8);
+   if (chunk_size > PGN_CHUNK_SIZE) chunk_size = PGN_CHUNK_SIZE;
+   if (chunk_size < PGN_CHUNK_MIN) chunk_size = PGN_CHUNK_MIN;
+
+   chunk_max = int(pgn->buf_size / chunk_size) + 1;
+
+   *chunk = (pgn_chunk_t *) my_malloc(chunk_max*sizeof(pgn_chunk_t));
+
+   return pgn_split(pgn,chunk_size,*chunk,chunk_max);
+}
+
+// shards_parallel()
+
+static int shards_parallel(const pgn_t * pgn, int thread_nb, int shard_nb, int record_size, ingest_game_t game, ingest_apply_t apply, FILE * log) {
+
+   shards_t shards[1];
+   pgn_chunk_t * chunk;
+   int chunk_nb;
+   int window;
+   int first;
+   int game_nb;
+   int i, j;
+
+   ASSERT(pgn!=NULL);
+
+   chunk_nb = ingest_split(pgn,thread_nb,&chunk);
+   window = ingest_window(thread_nb);
+
+   shards->pgn = pgn;
+   shards->game = game;
+   shards->apply = apply;
+   shards->batch = (batch_t *) my_malloc(window*sizeof(batch_t));
+
+   for (i = 0; i < window; i++) {
+      for (j = 0; j < shard_nb; j++) {
+         record_list_init(&shards->batch[i].list[j],record_size);
+      }
+   }
+
+   // replay a window of chunks in parallel, then let each shard apply its
+   // records in input order, so that entries are created in game order
+
+   game_nb = 0;
+
+   for (first = 0; first < chunk_nb; first += shards->batch_nb) {
+
+      shards->batch_nb = chunk_nb - first;
+      if (shards->batch_nb > window) shards->batch_nb = window;
+
+      for (i = 0; i < shards->batch_nb; i++) {
+         shards->batch[i].pgn = chunk[first+i];
+         shards->batch[i].game_nb = 0;
+      }
+
+      shards->next = 0;
+
+      thread_run(thread_nb,parse_thread,shards);
+      thread_run(shard_nb,apply_thread,shards);
+
+      for (i = 0; i < shards->batch_nb; i++) {
+         if ((game_nb + shards->batch[i].game_nb) / 10000 != game_nb / 10000) {
+            fprintf(log,"%d games ...\n",game_nb+shards->batch[i].game_nb);
+         }
+         game_nb += shards->batch[i].game_nb;
+      }
+   }
+
+   for (i = 0; i < window; i++) {
+      for (j = 0; j < shard_nb; j++) {
+         record_list_free(&shards->batch[i].list[j]);
+      }
+   }
+
+   my_free(shards->batch);
+   my_free(chunk);
+
+   return game_nb;
+}
+
+// parse_thread()
+
+static void parse_thread(int, void * data) {
+
+   shards_t * shards;
+   batch_t * batch;
+   pgn_t pgn[1];
+   int i;
+
+   ASSERT(data!=NULL);
+
+   shards = (shards_t *) data;
+
+   while ((i = thread_next(&shards->next)) < shards->batch_nb) {
+
+      batch = &shards->batch[i];
+
+      pgn_open_mem(pgn,&shards->pgn->buf[batch->pgn.pos],batch->pgn.size,batch->pgn.line);
+
+      while (pgn_next_game(pgn)) {
+         shards->game(pgn,batch->list);
+         batch->game_nb++;
+      }
+
+      pgn_close(pgn);
+   }
+}
+
+// apply_thread()
+
+static void apply_thread(int id, void * data) {
+
+   shards_t * shards;
+   record_list_t * list;
+   int i;
+
+   ASSERT(id>=0);
+   ASSERT(data!=NULL);
+
+   shards = (shards_t *) data;
+
+   for (i = 0; i < shards->batch_nb; i++) {
+      list = &shards->batch[i].list[id];
+      shards->apply(id,list);
+      list->size = 0;
+   }
+}
+
+// map_thread()
+
+static void map_thread(int, void * data) {
+
+   map_t * ctx;
+   pgn_t pgn[1];
+   int slot;
+   int game_nb;
+   int i;
+
+   ASSERT(data!=NULL);
+
+   ctx = (map_t *) data;
+
+   while ((i = thread_next(&ctx->next)) < ctx->chunk_nb) {
+
+      // the slot is free once the writer is done with chunk i - window
+
+      thread_seq_enter(ctx->seq,i);
+
+      slot = i % ctx->window;
+      game_nb = 0;
+
+      pgn_open_mem(pgn,&ctx->pgn->buf[ctx->chunk[i].pos],ctx->chunk[i].size,ctx->chunk[i].line);
+
+      while (pgn_next_game(pgn)) {
+         ctx->map(pgn,slot,ctx->data);
+         game_nb++;
+      }
+
+      pgn_close(pgn);
+
+      ctx->game_nb[i] = game_nb;
+
+      thread_seq_done(ctx->seq,i);
+   }
+}
+
+// end of ingest.cpp
+
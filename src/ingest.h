@@ -0,0 +1,53 @@
+
+// ingest.h
+
+#ifndef INGEST_H
+#define INGEST_H
+
+// includes
+
+#include <cstdio>
+
+#include "pgn.h"
+#include "thread.h"
+#include "util.h"
+
+// types
+
+// records of a game batch bound for one shard; each tool has its own
+// record layout, so that the list only knows the record size
+
+struct record_list_t {
+   int size;
+   int alloc;
+   int record_size;
+   char * record;
+};
+
+// shard ingestion: "game" replays one game into per-shard record lists,
+// "apply" adds one list to its shard, lists reach a shard in input order
+
+typedef void (*ingest_game_t)  (pgn_t * pgn, record_list_t list[]);
+typedef void (*ingest_apply_t) (int shard, record_list_t * list);
+
+// ordered map: "map" handles one game of a chunk into a window slot,
+// "write" gets the slots back in input order and must empty them
+
+typedef void (*ingest_map_t)   (pgn_t * pgn, int slot, void * data);
+typedef void (*ingest_write_t) (int slot, int game_nb, void * data);
+
+// functions
+
+extern void   record_list_init (record_list_t * list, int record_size);
+extern void   record_list_free (record_list_t * list);
+extern void * record_new       (record_list_t * list);
+
+extern int    ingest_shards    (pgn_t * pgn, int thread_nb, int shard_nb, int record_size, ingest_game_t game, ingest_apply_t apply, FILE * log);
+
+extern int    ingest_window    (int thread_nb);
+extern void   ingest_map       (const pgn_t * pgn, int thread_nb, ingest_map_t map, ingest_write_t write, void * data);
+
+#endif // !defined INGEST_H
+
+// end of ingest.h
+
@@ -11,6 +11,7 @@
 
 #include "adapter.h"
 #include "attack.h"
+#include "bitboard.h"
 #include "board.h"
 #include "book.h"
 #include "book_make.h"
@@ -26,6 +27,7 @@
 #include "move.h"
 #include "move_gen.h"
 #include "option.h"
+#include "perft.h"
 #include "piece.h"
 #include "search.h"
 #include "square.h"
@@ -80,6 +82,7 @@ int main(int argc, char * argv[]) {
    square_init();
    piece_init();
    attack_init();
+   bitboard_init();
 
    hash_init();
 
@@ -107,6 +110,13 @@ int main(int argc, char * argv[]) {
       return EXIT_SUCCESS;
    }
 
+   // move-generator test
+
+   if (argc >= 2 && my_string_equal(argv[1],"perft")) {
+      perft_test(argc,argv);
+      return EXIT_SUCCESS;
+   }
+
    // read options
 
    if (argc == 2) option_set("OptionFile",argv[1]); // HACK for compatibility
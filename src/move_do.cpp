@@ -5,6 +5,7 @@
 
 #include <cstdlib>
 
+#include "bitboard.h"
 #include "board.h"
 #include "colour.h"
 #include "hash.h"
@@ -27,6 +28,15 @@ static void square_move  (board_t * board, int from, int to, int piece);
 
 void move_do(board_t * board, int move) {
 
+   undo_t undo[1];
+
+   move_do(board,move,undo);
+}
+
+// move_do()
+
+void move_do(board_t * board, int move, undo_t * undo) {
+
    int me, opp;
    int from, to;
    int piece, pos, capture;
@@ -53,6 +63,23 @@ void move_do(board_t * board, int move) {
    pos = board->pos[from];
    ASSERT(pos>=0);
 
+   // save state
+
+   undo->castling = false;
+   undo->capture = false;
+
+   undo->turn = board->turn;
+   undo->castle[White][SideH] = board->castle[White][SideH];
+   undo->castle[White][SideA] = board->castle[White][SideA];
+   undo->castle[Black][SideH] = board->castle[Black][SideH];
+   undo->castle[Black][SideA] = board->castle[Black][SideA];
+   undo->ep_square = board->ep_square;
+
+   undo->ply_nb = board->ply_nb;
+   undo->move_nb = board->move_nb;
+
+   undo->key = board->key;
+
    // update turn
 
    board->turn = opp;
@@ -141,6 +168,8 @@ void move_do(board_t * board, int move) {
 
       square_set(board,rook_to,rook,pos);
 
+      undo->castling = true;
+
       ASSERT(board->key==hash_key(board));
 
       return;
@@ -156,6 +185,11 @@ void move_do(board_t * board, int move) {
       capture = board->square[sq];
       ASSERT(capture==piece_make_pawn(opp));
 
+      undo->capture = true;
+      undo->capture_square = sq;
+      undo->capture_piece = capture;
+      undo->capture_pos = board->pos[sq];
+
       square_clear(board,sq,capture);
 
       board->ply_nb = 0; // conversion
@@ -171,6 +205,11 @@ void move_do(board_t * board, int move) {
          ASSERT(colour_equal(capture,opp));
          ASSERT(!piece_is_king(capture));
 
+         undo->capture = true;
+         undo->capture_square = to;
+         undo->capture_piece = capture;
+         undo->capture_pos = board->pos[to];
+
          square_clear(board,to,capture);
 
          board->ply_nb = 0; // conversion
@@ -197,6 +236,112 @@ void move_do(board_t * board, int move) {
    ASSERT(board->key==hash_key(board));
 }
 
+// move_undo()
+
+void move_undo(board_t * board, int move, const undo_t * undo) {
+
+   int me;
+   int from, to;
+   int piece, pos;
+
+   ASSERT(board!=NULL);
+   ASSERT(move_is_ok(move));
+   ASSERT(undo!=NULL);
+
+   // init
+
+   me = undo->turn;
+
+   from = move_from(move);
+   to = move_to(move);
+
+   if (undo->castling) {
+
+      // castle
+
+      int rank;
+      int king_from, king_to;
+      int rook_from, rook_to;
+      int rook;
+
+      rank = colour_is_white(me) ? Rank1 : Rank8;
+
+      king_from = from;
+      rook_from = to;
+
+      if (to > from) { // h side
+         king_to = square_make(FileG,rank);
+         rook_to = square_make(FileF,rank);
+      } else { // a side
+         king_to = square_make(FileC,rank);
+         rook_to = square_make(FileD,rank);
+      }
+
+      // remove the rook
+
+      pos = board->pos[rook_to];
+      ASSERT(pos>=0);
+
+      rook = Rook64 | me; // HACK
+
+      square_clear(board,rook_to,rook);
+
+      // move the king back
+
+      square_move(board,king_to,king_from,board->square[king_to]);
+
+      // put the rook back
+
+      square_set(board,rook_from,rook,pos);
+
+   } else {
+
+      // move the piece back
+
+      piece = board->square[to];
+      ASSERT(colour_equal(piece,me));
+
+      if (move_is_promote(move)) {
+
+         // demote
+
+         pos = board->pos[to];
+         ASSERT(pos>=0);
+
+         square_clear(board,to,piece);
+         square_set(board,from,piece_make_pawn(me),pos);
+
+      } else {
+
+         // normal move
+
+         square_move(board,to,from,piece);
+      }
+
+      // put the captured piece back
+
+      if (undo->capture) {
+         square_set(board,undo->capture_square,undo->capture_piece,undo->capture_pos);
+      }
+   }
+
+   // restore state
+
+   board->turn = undo->turn;
+   board->castle[White][SideH] = undo->castle[White][SideH];
+   board->castle[White][SideA] = undo->castle[White][SideA];
+   board->castle[Black][SideH] = undo->castle[Black][SideH];
+   board->castle[Black][SideA] = undo->castle[Black][SideA];
+   board->ep_square = undo->ep_square;
+
+   board->ply_nb = undo->ply_nb;
+   board->move_nb = undo->move_nb;
+
+   board->key = undo->key;
+
+   ASSERT(board->key==hash_key(board));
+}
+
 // square_clear()
 
 static void square_clear(board_t * board, int square, int piece) {
@@ -250,6 +395,11 @@ static void square_clear(board_t * board, int square, int piece) {
    ASSERT(board->number[piece_12]>=1);
    board->number[piece_12]--;
 
+   // bitboards
+
+   board->piece_bb[piece_12] ^= SquareBit[square];
+   board->colour_bb[colour] ^= SquareBit[square];
+
    // hash key
 
    board->key ^= random_64(RandomPiece+piece_12*64+square_to_64(square));
@@ -306,6 +456,11 @@ static void square_set(board_t * board, int square, int piece, int pos) {
    ASSERT(board->number[piece_12]<=8);
    board->number[piece_12]++;
 
+   // bitboards
+
+   board->piece_bb[piece_12] ^= SquareBit[square];
+   board->colour_bb[colour] ^= SquareBit[square];
+
    // hash key
 
    board->key ^= random_64(RandomPiece+piece_12*64+square_to_64(square));
@@ -317,6 +472,7 @@ static void square_move(board_t * board, int from, int to, int piece) {
 
    int colour, pos;
    int piece_index;
+   uint64 bits;
 
    ASSERT(board!=NULL);
    ASSERT(square_is_ok(from));
@@ -351,6 +507,13 @@ static void square_move(board_t * board, int from, int to, int piece) {
    ASSERT(board->list[colour][pos]==from);
    board->list[colour][pos] = to;
 
+   // bitboards
+
+   bits = SquareBit[from] ^ SquareBit[to];
+
+   board->piece_bb[piece_to_12(piece)] ^= bits;
+   board->colour_bb[colour] ^= bits;
+
    // hash key
 
    piece_index = RandomPiece + piece_to_12(piece) * 64;
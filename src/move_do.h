@@ -9,9 +9,32 @@
 #include "board.h"
 #include "util.h"
 
+// types
+
+struct undo_t {
+
+   bool castling;
+   bool capture;
+
+   int capture_square;
+   int capture_piece;
+   int capture_pos;
+
+   int turn;
+   int castle[ColourNb][SideNb];
+   int ep_square;
+
+   int ply_nb;
+   int move_nb;
+
+   uint64 key;
+};
+
 // functions
 
-extern void move_do (board_t * board, int move);
+extern void move_do   (board_t * board, int move);
+extern void move_do   (board_t * board, int move, undo_t * undo);
+extern void move_undo (board_t * board, int move, const undo_t * undo);
 
 #endif // !defined MOVE_DO_H
 
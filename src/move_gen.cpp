@@ -4,6 +4,7 @@
 // includes
 
 #include "attack.h"
+#include "bitboard.h"
 #include "board.h"
 #include "colour.h"
 #include "list.h"
@@ -19,6 +20,7 @@ static void add_all_moves    (list_t * list, const board_t * board);
 static void add_castle_moves (list_t * list, const board_t * board);
 
 static void add_pawn_move    (list_t * list, int from, int to);
+static void add_bb_moves     (list_t * list, int from, uint64 targets);
 
 // functions
 
@@ -56,6 +58,7 @@ static void add_all_moves(list_t * list, const board_t * board) {
    int from, to;
    int inc;
    int piece, capture;
+   uint64 occupied;
 
    ASSERT(list_is_ok(list));
    ASSERT(board_is_ok(board));
@@ -63,11 +66,18 @@ static void add_all_moves(list_t * list, const board_t * board) {
    me = board->turn;
    opp = colour_opp(me);
 
+   occupied = board_occupied(board);
+
    for (ptr = board->list[me]; (from=*ptr) != SquareNone; ptr++) {
 
       piece = board->square[from];
       ASSERT(colour_equal(piece,me));
 
+      if (UseBitboard && !piece_is_pawn(piece)) {
+         add_bb_moves(list,from,piece_attack_bb(piece,square_to_64(from),occupied)&~board->colour_bb[me]);
+         continue;
+      }
+
       switch (piece_type(piece)) {
 
       case WhitePawn64:
@@ -324,5 +334,17 @@ static void add_pawn_move(list_t * list, int from, int to) {
    }
 }
 
+// add_bb_moves()
+
+static void add_bb_moves(list_t * list, int from, uint64 targets) {
+
+   ASSERT(list_is_ok(list));
+   ASSERT(square_is_ok(from));
+
+   for (; targets != 0; targets &= targets - 1) {
+      list_add(list,move_make(from,square_from_64(bit_first(targets))));
+   }
+}
+
 // end of move_gen.cpp
 
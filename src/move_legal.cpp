@@ -52,6 +52,27 @@ bool pseudo_is_legal(int move, const board_t * board) {
    return !is_in_check(new_board,colour_opp(new_board->turn));
 }
 
+// pseudo_is_legal_do()
+
+bool pseudo_is_legal_do(int move, board_t * board) {
+
+   undo_t undo[1];
+   bool legal;
+
+   ASSERT(move_is_ok(move));
+   ASSERT(board_is_ok(board));
+
+   ASSERT(move_is_pseudo(move,board));
+
+   // plays the move and takes it back, for loops over one scratch board
+
+   move_do(board,move,undo);
+   legal = !is_in_check(board,colour_opp(board->turn));
+   move_undo(board,move,undo);
+
+   return legal;
+}
+
 // move_is_legal()
 
 bool move_is_legal(int move, const board_t * board) {
@@ -71,12 +92,15 @@ bool move_is_legal(int move, const board_t * board) {
 
 void filter_legal(list_t * list, const board_t * board) {
 
+   board_t new_board[1];
    int pos;
    int i, move, value;
 
    ASSERT(list_is_ok(list));
    ASSERT(board_is_ok(board));
 
+   board_copy(new_board,board);
+
    pos = 0;
 
    for (i = 0; i < list_size(list); i++) {
@@ -86,7 +110,7 @@ void filter_legal(list_t * list, const board_t * board) {
       move = list_move(list,i);
       value = list_value(list,i);
 
-      if (pseudo_is_legal(move,board)) {
+      if (pseudo_is_legal_do(move,new_board)) {
          list->move[pos] = move;
          list->value[pos] = value;
          pos++;
@@ -14,6 +14,7 @@
 
 extern bool move_is_pseudo  (int move, const board_t * board);
 extern bool pseudo_is_legal (int move, const board_t * board);
+extern bool pseudo_is_legal_do (int move, board_t * board);
 extern bool move_is_legal   (int move, const board_t * board);
 
 extern void filter_legal    (list_t * list, const board_t * board);
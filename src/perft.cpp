@@ -0,0 +1,309 @@
+
+// perft.cpp
+
+// includes
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "attack.h"
+#include "board.h"
+#include "fen.h"
+#include "list.h"
+#include "move.h"
+#include "move_do.h"
+#include "move_gen.h"
+#include "move_legal.h"
+#include "perft.h"
+#include "search.h"
+#include "thread.h"
+#include "util.h"
+
+// constants
+
+static const int HashMax = 1024; // MB
+
+// types
+
+struct hash_entry_t {
+   volatile uint64 lock; // key ^ data, detects torn entries from other threads
+   volatile uint64 data; // count << 8 | depth
+};
+
+struct root_t {
+   const board_t * board;
+   int depth;
+   list_t list[1];
+   sint64 count[ListSize];
+   volatile int next;
+};
+
+// variables
+
+static int Threads;
+
+static hash_entry_t * Hash;
+static uint64 HashMask;
+
+// prototypes
+
+static void   hash_alloc  (int mb);
+static void   hash_free   ();
+static bool   hash_get    (uint64 key, int depth, sint64 * count);
+static void   hash_set    (uint64 key, int depth, sint64 count);
+
+static void   root_thread (int id, void * data);
+
+static sint64 perft       (board_t * board, int depth);
+
+// functions
+
+// perft_test()
+
+void perft_test(int argc, char * argv[]) {
+
+   int i;
+   const char * fen;
+   int depth;
+   int hash_mb;
+   board_t board[1];
+   root_t root[1];
+   my_timer_t timer[1];
+   sint64 total;
+   double time, speed;
+   char move_string[256];
+
+   fen = NULL;
+   my_string_set(&fen,StartFen);
+
+   depth = 5;
+   hash_mb = 0;
+   Threads = 1;
+
+   for (i = 1; i < argc; i++) {
+
+      if (false) {
+
+      } else if (my_string_equal(argv[i],"perft")) {
+
+         // skip
+
+      } else if (my_string_equal(argv[i],"-fen")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("perft_test(): missing argument\n");
+
+         my_string_set(&fen,argv[i]);
+
+      } else if (my_string_equal(argv[i],"-depth")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("perft_test(): missing argument\n");
+
+         depth = atoi(argv[i]);
+         if (depth < 1 || depth > DepthMax) my_fatal("perft_test(): bad depth %d\n",depth);
+
+      } else if (my_string_equal(argv[i],"-threads")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("perft_test(): missing argument\n");
+
+         Threads = atoi(argv[i]);
+         if (Threads <= 0) Threads = thread_nb_default();
+         if (Threads > ThreadMax) Threads = ThreadMax;
+
+      } else if (my_string_equal(argv[i],"-hash")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("perft_test(): missing argument\n");
+
+         hash_mb = atoi(argv[i]);
+         if (hash_mb < 0 || hash_mb > HashMax) my_fatal("perft_test(): bad hash size %d\n",hash_mb);
+
+      } else {
+
+         my_fatal("perft_test(): unknown option \"%s\"\n",argv[i]);
+      }
+   }
+
+   if (!board_from_fen(board,fen)) my_fatal("perft_test(): bad FEN \"%s\"\n",fen);
+
+   hash_alloc(hash_mb);
+
+   board_disp(board);
+
+   // root moves are shared out to the threads one at a time
+
+   root->board = board;
+   root->depth = depth;
+   gen_legal_moves(root->list,board);
+   root->next = 0;
+
+   my_timer_reset(timer);
+
+   my_timer_start(timer);
+   thread_run(Threads,root_thread,root);
+   my_timer_stop(timer);
+
+   // divide
+
+   total = 0;
+
+   for (i = 0; i < list_size(root->list); i++) {
+      if (!move_to_can(list_move(root->list,i),board,move_string,256)) my_fatal("perft_test(): move_to_can() failed\n");
+      printf("%s %lld\n",move_string,root->count[i]);
+      total += root->count[i];
+   }
+
+   time = my_timer_elapsed_real(timer);
+   speed = (time < 0.01) ? 0.0 : double(total) / time;
+
+   printf("\n");
+   printf("depth %d moves %d nodes %lld time %.2f nps %.0f\n",depth,list_size(root->list),total,time,speed);
+
+   hash_free();
+   my_string_clear(&fen);
+}
+
+// hash_alloc()
+
+static void hash_alloc(int mb) {
+
+   uint64 size;
+
+   ASSERT(mb>=0&&mb<=HashMax);
+
+   Hash = NULL;
+   HashMask = 0;
+
+   if (mb == 0) return;
+
+   for (size = 1; size * 2 * sizeof(hash_entry_t) <= uint64(mb) << 20; size *= 2)
+      ;
+
+   Hash = (hash_entry_t *) my_malloc(int(size*sizeof(hash_entry_t)));
+   HashMask = size - 1;
+
+   for (size = 0; size <= HashMask; size++) {
+      Hash[size].lock = 0;
+      Hash[size].data = 0; // depth 0 is never stored
+   }
+}
+
+// hash_free()
+
+static void hash_free() {
+
+   if (Hash != NULL) my_free(Hash);
+
+   Hash = NULL;
+   HashMask = 0;
+}
+
+// hash_get()
+
+static bool hash_get(uint64 key, int depth, sint64 * count) {
+
+   hash_entry_t * entry;
+   uint64 lock, data;
+
+   ASSERT(Hash!=NULL);
+   ASSERT(depth>0&&depth<=DepthMax);
+   ASSERT(count!=NULL);
+
+   entry = &Hash[key&HashMask];
+
+   data = entry->data;
+   lock = entry->lock;
+
+   if ((lock ^ data) != key || int(data & 0xFF) != depth) return false;
+
+   *count = sint64(data >> 8);
+
+   return true;
+}
+
+// hash_set()
+
+static void hash_set(uint64 key, int depth, sint64 count) {
+
+   hash_entry_t * entry;
+   uint64 data;
+
+   ASSERT(Hash!=NULL);
+   ASSERT(depth>0&&depth<=DepthMax);
+   ASSERT(count>=0);
+
+   entry = &Hash[key&HashMask];
+
+   data = (uint64(count) << 8) | depth;
+
+   entry->data = data;
+   entry->lock = key ^ data;
+}
+
+// root_thread()
+
+static void root_thread(int, void * data) {
+
+   root_t * root;
+   board_t board[1];
+   undo_t undo[1];
+   int i, move;
+
+   root = (root_t *) data;
+   board_copy(board,root->board);
+
+   while ((i = thread_next(&root->next)) < list_size(root->list)) {
+
+      move = list_move(root->list,i);
+
+      move_do(board,move,undo);
+      root->count[i] = perft(board,root->depth-1);
+      move_undo(board,move,undo);
+   }
+}
+
+// perft()
+
+static sint64 perft(board_t * board, int depth) {
+
+   int me;
+   list_t list[1];
+   int i, move;
+   undo_t undo[1];
+   sint64 count;
+
+   ASSERT(board_is_ok(board));
+   ASSERT(depth>=0&&depth<=DepthMax);
+
+   // leaf
+
+   if (depth == 0) return 1;
+
+   // transposition
+
+   if (Hash != NULL && depth >= 2 && hash_get(board->key,depth,&count)) return count;
+
+   // move loop
+
+   me = board->turn;
+   count = 0;
+
+   gen_moves(list,board);
+
+   for (i = 0; i < list_size(list); i++) {
+
+      move = list_move(list,i);
+
+      move_do(board,move,undo);
+      if (!is_in_check(board,me)) count += perft(board,depth-1);
+      move_undo(board,move,undo);
+   }
+
+   if (Hash != NULL && depth >= 2) hash_set(board->key,depth,count);
+
+   return count;
+}
+
+// end of perft.cpp
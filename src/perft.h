@@ -0,0 +1,17 @@
+
+// perft.h
+
+#ifndef PERFT_H
+#define PERFT_H
+
+// includes
+
+#include "util.h"
+
+// functions
+
+extern void perft_test (int argc, char * argv[]);
+
+#endif // !defined PERFT_H
+
+// end of perft.h
@@ -8,6 +8,12 @@
 #include <cstdio>
 #include <cstring>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "stdlib.h"
 #include "pgn.h"
 #include "util.h"
@@ -18,10 +24,16 @@ static const bool DispMove = false;
 static const bool DispToken = false;
 static const bool DispChar = false;
 
+static const bool UseMmap = true;
+
 static const int TAB_SIZE = 8;
 
 static const int CHAR_EOF = 256;
 
+static const int CHAR_BLANK = 1 << 0; // character classes for splitting
+static const int CHAR_START = 1 << 1;
+static const int CHAR_NEXT  = 1 << 2;
+
 // types
 
 enum token_t {
@@ -49,20 +61,94 @@ static void pgn_skip_blanks  (pgn_t * pgn);
 static void pgn_char_read    (pgn_t * pgn);
 static void pgn_char_unread  (pgn_t * pgn);
 
+static void pgn_init         (pgn_t * pgn, int line);
+static bool pgn_buf_fill     (pgn_t * pgn);
+
+static sint64 next_game_start (const char string[], sint64 size, sint64 pos, sint64 min_pos, const uint8 type[]);
+static bool is_result        (const char string[], sint64 size);
+static bool is_line_start    (const char string[], sint64 size, sint64 pos);
+
+bool is_bomchar (unsigned char c);
+
 // functions
 
 // pgn_open()
 
 void pgn_open(pgn_t * pgn, const char file_name[]) {
 
+   struct stat st[1];
+   void * address;
+
    ASSERT(pgn!=NULL);
    ASSERT(file_name!=NULL);
 
-   pgn->file = fopen(file_name,"r");
-   if (pgn->file == NULL) my_fatal("pgn_open(): can't open file \"%s\": %s\n",file_name,strerror(errno));
+   pgn->fd = open(file_name,O_RDONLY);
+   if (pgn->fd == -1) my_fatal("pgn_open(): can't open file \"%s\": %s\n",file_name,strerror(errno));
+
+   // map regular files, fall back to read-ahead blocks for pipes etc.
+
+   pgn->buf = NULL;
+   pgn->buf_size = 0;
+   pgn->buf_alloc = 0;
+   pgn->buf_pos = 0;
+   pgn->buf_mapped = false;
+
+   pgn->game_pos = 0;
+
+   if (UseMmap && fstat(pgn->fd,st) != -1 && S_ISREG(st->st_mode) && st->st_size > 0) {
+
+      address = mmap(NULL,st->st_size,PROT_READ,MAP_PRIVATE,pgn->fd,0);
+
+      if (address != MAP_FAILED) {
+         madvise(address,st->st_size,MADV_SEQUENTIAL);
+         pgn->buf = (const char *) address;
+         pgn->buf_size = st->st_size;
+         pgn->buf_alloc = st->st_size;
+         pgn->buf_mapped = true;
+      }
+   }
+
+   if (!pgn->buf_mapped) {
+      pgn->buf_alloc = PGN_BLOCK_SIZE;
+      pgn->buf = (const char *) my_malloc(pgn->buf_alloc);
+   }
+
+   pgn_init(pgn,1);
+}
+
+// pgn_open_mem()
+
+void pgn_open_mem(pgn_t * pgn, const char string[], sint64 size, int line) {
+
+   ASSERT(pgn!=NULL);
+   ASSERT(string!=NULL||size==0);
+   ASSERT(size>=0);
+   ASSERT(line>=1);
+
+   // borrowed buffer, typically a chunk of a mapped file
+
+   pgn->fd = -1;
+
+   pgn->buf = string;
+   pgn->buf_size = size;
+   pgn->buf_alloc = size;
+   pgn->buf_pos = 0;
+   pgn->buf_mapped = true;
+
+   pgn->game_pos = 0;
+
+   pgn_init(pgn,line);
+}
+
+// pgn_init()
+
+static void pgn_init(pgn_t * pgn, int line) {
+
+   ASSERT(pgn!=NULL);
+   ASSERT(line>=1);
 
    pgn->char_hack = CHAR_EOF; // DEBUG
-   pgn->char_line = 1;
+   pgn->char_line = line;
    pgn->char_column = 0;
    pgn->char_unread = false;
    pgn->char_first = true;
@@ -91,7 +177,234 @@ void pgn_close(pgn_t * pgn) {
 
    ASSERT(pgn!=NULL);
 
-   fclose(pgn->file);
+   if (pgn->fd == -1) return; // pgn_open_mem()
+
+   if (pgn->buf_mapped) {
+      munmap((void *)pgn->buf,pgn->buf_size);
+   } else {
+      my_free((void *)pgn->buf);
+   }
+
+   close(pgn->fd);
+}
+
+// pgn_split()
+
+int pgn_split(const pgn_t * pgn, sint64 chunk_size, pgn_chunk_t chunk[], int chunk_max) {
+
+   const char * string;
+   sint64 size;
+   sint64 start, pos, end;
+   const char * ptr;
+   int chunk_nb;
+   int line;
+   uint8 type[256];
+   int c;
+
+   ASSERT(pgn!=NULL);
+   ASSERT(pgn->buf_mapped);
+   ASSERT(chunk_size>0);
+   ASSERT(chunk!=NULL);
+   ASSERT(chunk_max>=1);
+
+   string = pgn->buf;
+   size = pgn->buf_size;
+
+   if (chunk_size < size / chunk_max + 1) chunk_size = size / chunk_max + 1;
+
+   // character classes of the lexer, looked up once per byte
+
+   for (c = 0; c < 256; c++) {
+      type[c] = 0;
+      if (isspace(c) || is_bomchar(c)) type[c] |= CHAR_BLANK;
+      if (is_symbol_start(c)) type[c] |= CHAR_START;
+      if (is_symbol_next(c)) type[c] |= CHAR_NEXT;
+   }
+
+   // cut where pgn_next_game() would start a game, so that every chunk
+   // holds whole games and parses exactly like the same bytes in the file
+
+   chunk_nb = 0;
+   line = 1;
+
+   for (start = 0; start < size; start = end) {
+
+      ASSERT(chunk_nb<chunk_max);
+
+      if (chunk_nb == chunk_max-1) {
+         end = size;
+      } else {
+         end = next_game_start(string,size,start,start+chunk_size,type);
+      }
+
+      ASSERT(end>start&&end<=size);
+
+      chunk[chunk_nb].pos = start;
+      chunk[chunk_nb].size = end - start;
+      chunk[chunk_nb].line = line;
+      chunk_nb++;
+
+      // line number of the next chunk
+
+      for (pos = start; (ptr = (const char *) memchr(&string[pos],'\n',end-pos)) != NULL; pos = (ptr - string) + 1) {
+         line++;
+      }
+   }
+
+   return chunk_nb;
+}
+
+// next_game_start()
+
+static sint64 next_game_start(const char string[], sint64 size, sint64 pos, sint64 min_pos, const uint8 type[]) {
+
+   sint64 start; // game start candidate, -1 = none
+   sint64 end;
+   int depth;
+   int c;
+
+   ASSERT(string!=NULL);
+   ASSERT(pos>=0&&pos<=size);
+   ASSERT(type!=NULL);
+
+   // follow the lexer from a game boundary, skipping comments and strings
+   // the way pgn_skip_blanks() and pgn_read_token() do; a game starts
+   // where the result token and its look-ahead character end, provided
+   // the next token is a tag; only cut where no token is left on the
+   // line, so that the chunk's columns (for "%" comments) are exact
+
+   start = -1;
+   depth = 0;
+
+   while (pos < size) {
+
+      c = (unsigned char) string[pos];
+
+      if (false) {
+
+      } else if ((type[c] & CHAR_BLANK) != 0) {
+
+         pos++;
+
+      } else if ((type[c] & CHAR_START) != 0) {
+
+         // symbol, integer, or result; the look-ahead character is consumed
+
+         end = pos + 1;
+         while (end < size && (type[(unsigned char)string[end]] & CHAR_NEXT) != 0) end++;
+
+         start = -1;
+
+         if (depth == 0 && is_result(&string[pos],end-pos)
+          && end < size && isspace((unsigned char)string[end])
+          && is_line_start(string,size,end+1)) {
+            start = end + 1;
+         }
+
+         pos = end;
+
+      } else if (c == '{') {
+
+         // comment to next '}'
+
+         end = pos + 1;
+         while (end < size && string[end] != '}') end++;
+         pos = (end < size) ? end + 1 : size;
+
+      } else if (c == ';' || (c == '%' && (pos == 0 || string[pos-1] == '\n'))) {
+
+         // comment to EOL
+
+         end = pos + 1;
+         while (end < size && string[end] != '\n') end++;
+         pos = (end < size) ? end + 1 : size;
+
+      } else if (c == '[') {
+
+         if (start >= min_pos) return start;
+
+         start = -1;
+         pos++;
+
+      } else {
+
+         // any other token, only a result can end a game
+
+         start = -1;
+
+         if (false) {
+
+         } else if (c == '"') {
+
+            // string, ends with '"' or ']' like in pgn_read_token()
+
+            end = pos + 1;
+            while (end < size && string[end] != '"' && string[end] != ']') end++;
+            pos = (end < size) ? end + 1 : size;
+
+         } else if (c == '$') {
+
+            // NAG
+
+            pos++;
+            while (pos < size && isdigit((unsigned char)string[pos])) pos++;
+
+         } else if (c == '(') {
+
+            depth++;
+            pos++;
+
+         } else if (c == ')') {
+
+            if (depth > 0) depth--;
+            pos++;
+
+         } else if (c == '*') {
+
+            // no look-ahead
+
+            pos++;
+            if (depth == 0 && is_line_start(string,size,pos)) start = pos;
+
+         } else {
+
+            pos++;
+         }
+      }
+   }
+
+   return size;
+}
+
+// is_result()
+
+static bool is_result(const char string[], sint64 size) {
+
+   ASSERT(string!=NULL);
+   ASSERT(size>0);
+
+   if (size == 3) return strncmp(string,"1-0",3) == 0 || strncmp(string,"0-1",3) == 0;
+   if (size == 7) return strncmp(string,"1/2-1/2",7) == 0;
+
+   return false;
+}
+
+// is_line_start()
+
+static bool is_line_start(const char string[], sint64 size, sint64 pos) {
+
+   ASSERT(string!=NULL);
+   ASSERT(pos>0&&pos<=size);
+
+   // at the start of a line, or only blanks before the next one
+
+   if (string[pos-1] == '\n') return true;
+
+   for (; pos < size && string[pos] != '\n'; pos++) {
+      if (!isspace((unsigned char)string[pos])) return false;
+   }
+
+   return pos < size;
 }
 
 void skip_to_next_game(pgn_t * pgn) {
@@ -119,7 +432,7 @@ bool pgn_next_game(pgn_t * pgn) {
    strcpy(pgn->fen,"");
    pgn->white_elo = -1;
    pgn->black_elo = -1;
-   pgn->game_string_len = 0;
+   pgn->game_pos = pgn->buf_pos;
 
    // loop
 
@@ -278,6 +591,22 @@ bool pgn_next_move(pgn_t * pgn, char string[], int size) {
    return false;
 }
 
+// pgn_game()
+
+void pgn_game(const pgn_t * pgn, const char * * string, sint64 * size) {
+
+   ASSERT(pgn!=NULL);
+   ASSERT(string!=NULL);
+   ASSERT(size!=NULL);
+
+   // every byte read since pgn_next_game(), valid until the next call
+
+   ASSERT(pgn->game_pos>=0&&pgn->game_pos<=pgn->buf_pos);
+
+   *string = &pgn->buf[pgn->game_pos];
+   *size = pgn->buf_pos - pgn->game_pos;
+}
+
 // pgn_token_read()
 
 static void pgn_token_read(pgn_t * pgn) {
@@ -663,20 +992,12 @@ static void pgn_char_read(pgn_t * pgn) {
 
    // read a new character
 
-   pgn->char_hack = fgetc(pgn->file);
-
-   if (pgn->char_hack == EOF) {
-      if (ferror(pgn->file)) my_fatal("pgn_char_read(): fgetc(): %s\n",strerror(errno));
+   if (pgn->buf_pos >= pgn->buf_size && !pgn_buf_fill(pgn)) {
       pgn->char_hack = TOKEN_EOF;
    } else {
-     if (pgn->char_hack != 0) {
-       pgn->game_string[(pgn->game_string_len)++] = (unsigned char)pgn->char_hack;
-       pgn->game_string[(pgn->game_string_len)] = 0;
-       //       printf("read one char:%c = %i. strlen is now %d (%d)\n", pgn->char_hack, pgn->char_hack, pgn->game_string_len, (int)strlen(pgn->game_string));
-     }
+      pgn->char_hack = (unsigned char) pgn->buf[pgn->buf_pos++];
    }
 
-
    if (DispChar) printf("< L%d C%d '%c' (%02X)\n",pgn->char_line,pgn->char_column,pgn->char_hack,pgn->char_hack);
 }
 
@@ -692,5 +1013,50 @@ static void pgn_char_unread(pgn_t * pgn) {
    pgn->char_unread = true;
 }
 
+// pgn_buf_fill()
+
+static bool pgn_buf_fill(pgn_t * pgn) {
+
+   char * buf;
+   sint64 keep;
+   int n;
+
+   ASSERT(pgn!=NULL);
+   ASSERT(pgn->buf_pos==pgn->buf_size);
+
+   if (pgn->buf_mapped) return false; // whole file already in memory
+
+   // keep the current game in the buffer
+
+   buf = (char *) pgn->buf;
+
+   keep = pgn->buf_size - pgn->game_pos;
+   ASSERT(keep>=0&&keep<=pgn->buf_alloc);
+
+   if (keep > 0 && pgn->game_pos > 0) memmove(buf,&buf[pgn->game_pos],keep);
+
+   if (pgn->buf_alloc - keep < PGN_BLOCK_SIZE / 2) { // long game
+      pgn->buf_alloc *= 2;
+      buf = (char *) my_realloc(buf,pgn->buf_alloc);
+      pgn->buf = buf;
+   }
+
+   pgn->game_pos = 0;
+   pgn->buf_size = keep;
+   pgn->buf_pos = keep;
+
+   // read the next block
+
+   do {
+      n = read(pgn->fd,&buf[keep],pgn->buf_alloc-keep);
+   } while (n == -1 && errno == EINTR);
+
+   if (n == -1) my_fatal("pgn_buf_fill(): read(): %s\n",strerror(errno));
+
+   pgn->buf_size += n;
+
+   return n > 0;
+}
+
 // end of pgn.cpp
 
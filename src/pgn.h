@@ -13,13 +13,24 @@
 // constants
 
 const int PGN_STRING_SIZE = 256;
-const int GAME_BUF_SIZE = 16000;
+
+const int PGN_BLOCK_SIZE = 1 << 20;
+const int PGN_CHUNK_SIZE = 4 << 20;
+const int PGN_CHUNK_MIN = 64 << 10;
 
 // types
 
 struct pgn_t {
 
-   FILE * file;
+   int fd;
+
+   const char * buf; // mapped file or read-ahead block
+   sint64 buf_size;
+   sint64 buf_alloc;
+   sint64 buf_pos;
+   bool buf_mapped;
+
+   sint64 game_pos; // start of the current game in buf
 
    int char_hack;
    int char_line;
@@ -43,19 +54,27 @@ struct pgn_t {
 
    int move_line;
    int move_column;
+};
 
-   char game_string[GAME_BUF_SIZE];
-  int game_string_len;
+struct pgn_chunk_t {
+   sint64 pos;
+   sint64 size;
+   int line;
 };
 
 // functions
 
 extern void pgn_open      (pgn_t * pgn, const char file_name[]);
+extern void pgn_open_mem  (pgn_t * pgn, const char string[], sint64 size, int line);
 extern void pgn_close     (pgn_t * pgn);
 
+extern int  pgn_split     (const pgn_t * pgn, sint64 chunk_size, pgn_chunk_t chunk[], int chunk_max);
+
 extern bool pgn_next_game (pgn_t * pgn);
 extern bool pgn_next_move (pgn_t * pgn, char string[], int size);
 
+extern void pgn_game      (const pgn_t * pgn, const char * * string, sint64 * size);
+
 #endif // !defined PGN_H
 
 // end of pgn.h
@@ -9,6 +9,7 @@
 #include <cstring>
 
 #include "attack.h"
+#include "bitboard.h"
 #include "board.h"
 #include "list.h"
 #include "move.h"
@@ -34,6 +35,7 @@ enum ambiguity_t {
 
 static bool san_to_lan    (const char san[], const board_t * board, char string[], int size);
 static int  move_from_lan (const char string[], const board_t * board);
+static bool lan_is_legal  (int move, const board_t * board);
 
 static int  ambiguity     (int move, const board_t * board);
 
@@ -158,6 +160,7 @@ int move_from_san(const char string[], const board_t * board) {
    san_to_lan(string,board,s,256);
    move = move_from_lan(s,board);
 
+   ASSERT(move==MoveNone||move_is_legal(move,board));
    ASSERT(!UseSlowDebug||move==move_from_san_debug(string,board));
 
    return move;
@@ -441,6 +444,8 @@ static int move_from_lan(const char string[], const board_t * board) {
 
       move = move_make(from,to) | promote;
 
+      if (!move_is_legal(move,board)) return MoveNone; // rare, full test
+
       return move;
    }
 
@@ -465,6 +470,8 @@ static int move_from_lan(const char string[], const board_t * board) {
 
       move = move_make(from,to) | promote;
 
+      if (!lan_is_legal(move,board)) return MoveNone;
+
       return move;
    }
 
@@ -489,7 +496,7 @@ static int move_from_lan(const char string[], const board_t * board) {
             if (true
              && (string[1] == '?' || file_to_char(square_file(from)) == string[1])
              && (string[2] == '?' || rank_to_char(square_rank(from)) == string[2])) {
-               if (!is_pinned(board,from,to,colour)) {
+               if (lan_is_legal(move_make(from,to)|promote,board)) {
                   move = move_make(from,to) | promote;
                   n++;
                }
@@ -503,6 +510,53 @@ static int move_from_lan(const char string[], const board_t * board) {
    return move;
 }
 
+// lan_is_legal()
+
+static bool lan_is_legal(int move, const board_t * board) {
+
+   int from, to;
+   int colour;
+   int piece, capture;
+
+   ASSERT(move_is_ok(move));
+   ASSERT(board_is_ok(board));
+
+   // move_from_lan() only proposes moves whose piece can reach the to square
+   // on the current board, so what is left is a handful of square tests;
+   // the rare cases go through the full move generator
+
+   from = move_from(move);
+   to = move_to(move);
+
+   colour = board->turn;
+   piece = board->square[from];
+   capture = board->square[to];
+
+   ASSERT(colour_equal(piece,colour));
+
+   if (capture != Empty && colour_equal(capture,colour)) return false;
+
+   if (piece_is_pawn(piece)) {
+
+      if (square_is_promote(to) != move_is_promote(move)) return false;
+
+      if (capture == Empty && square_file(to) != square_file(from)) {
+         if (to != board->ep_square) return false;
+         return move_is_legal(move,board); // en passant
+      }
+
+   } else if (move_is_promote(move)) {
+
+      return false;
+   }
+
+   if (is_in_check(board,colour)) return move_is_legal(move,board);
+
+   if (piece_is_king(piece)) return !is_attacked(board,to,colour_opp(colour));
+
+   return !is_pinned(board,from,to,colour);
+}
+
 // ambiguity()
 
 static int ambiguity(int move, const board_t * board) {
@@ -510,6 +564,7 @@ static int ambiguity(int move, const board_t * board) {
    int from, to, piece;
    list_t list[1];
    int i, n, m;
+   uint64 b;
 
    // init
 
@@ -517,7 +572,26 @@ static int ambiguity(int move, const board_t * board) {
    to = move_to(move);
    piece = move_piece(move,board);
 
-   gen_legal_moves(list,board);
+   if (UseBitboard) {
+
+      // same-type pieces seeing the to square, pieces attack symmetrically
+
+      ASSERT(!piece_is_pawn(piece));
+
+      list_clear(list);
+
+      b = piece_attack_bb(piece,square_to_64(to),board_occupied(board));
+      b &= board->piece_bb[piece_to_12(piece)];
+
+      for (; b != 0; b &= b - 1) {
+         m = move_make(square_from_64(bit_first(b)),to);
+         if (lan_is_legal(m,board)) list_add(list,m);
+      }
+
+   } else {
+
+      gen_legal_moves(list,board);
+   }
 
    // no ambiguity?
 
@@ -45,7 +45,7 @@ static int MoveNb;
 
 static bool depth_is_ok (int depth);
 
-static void perft       (const board_t * board, int depth);
+static void perft       (board_t * board, int depth);
 
 // functions
 
@@ -133,6 +133,7 @@ void search(const board_t * board, int depth_max, double time_max) {
 void search_perft(const board_t * board, int depth_max) {
 
    int depth;
+   board_t new_board[1];
    my_timer_t timer[1];
    double time, speed;
 
@@ -143,6 +144,8 @@ void search_perft(const board_t * board, int depth_max) {
 
    board_disp(board);
 
+   board_copy(new_board,board); // perft() plays and undoes moves in place
+
    // iterative deepening
 
    for (depth = 1; depth <= depth_max; depth++) {
@@ -155,7 +158,7 @@ void search_perft(const board_t * board, int depth_max) {
       my_timer_reset(timer);
 
       my_timer_start(timer);
-      perft(board,depth);
+      perft(new_board,depth);
       my_timer_stop(timer);
 
       time = my_timer_elapsed_cpu(timer);
@@ -169,12 +172,12 @@ void search_perft(const board_t * board, int depth_max) {
 
 // perft()
 
-static void perft(const board_t * board, int depth) {
+static void perft(board_t * board, int depth) {
 
    int me;
    list_t list[1];
    int i, move;
-   board_t new_board[1];
+   undo_t undo[1];
 
    ASSERT(board_is_ok(board));
    ASSERT(depth_is_ok(depth));
@@ -204,10 +207,9 @@ static void perft(const board_t * board, int depth) {
 
       move = list_move(list,i);
 
-      board_copy(new_board,board);
-      move_do(new_board,move);
-
-      if (!is_in_check(new_board,me)) perft(new_board,depth-1);
+      move_do(board,move,undo);
+      if (!is_in_check(board,me)) perft(board,depth-1);
+      move_undo(board,move,undo);
    }
 }
 
@@ -0,0 +1,345 @@
+
+// table.h
+
+#ifndef TABLE_H
+#define TABLE_H
+
+// includes
+
+#include <cstdio>
+#include <cstring>
+
+#include <sys/mman.h>
+
+#include "util.h"
+
+// constants
+
+const int TableNone = -1;
+
+const int TableAllocMax = 1 << 28;
+
+const int TableInitMax = 1 << 24; // larger tables grow as needed
+
+const int TableBytesPerEntry = 32; // PGN text per new position/move, on the high side
+const int TableBytesPerGame = 400; // PGN text per game, on the low side
+const int TableRepeat = 4; // games sharing their first moves, on the low side
+const int TableHugePageSize = 2 * 1024 * 1024;
+
+const bool UseHugePage = true;
+
+// types
+
+// position/move aggregation table used by the book tools
+// entries are kept densely in creation order, so that callers can filter
+// and sort them in place; the index is a Robin Hood linear-probe table
+// whose slots hold the low key bits next to the entry position, so that
+// probing and resizing rarely touch the entries themselves
+
+// T must be a plain struct with "uint64 key" and "move" members; the
+// functions are static because each tool has its own "entry_t"
+
+template <class T> struct table_t {
+   int size;
+   int alloc;
+   uint32 mask;
+   T * entry;
+   uint64 * slot; // 0 = empty, else (key low bits << 32) | (pos + 1)
+};
+
+// functions
+
+// table_slot_pos()
+
+inline int table_slot_pos(uint64 slot) {
+
+   return int(uint32(slot)) - 1;
+}
+
+// table_slot_dist()
+
+inline uint32 table_slot_dist(uint64 slot, uint32 index, uint32 mask) {
+
+   return (index - uint32(slot >> 32)) & mask;
+}
+
+// table_estimate()
+
+inline int table_estimate(sint64 pgn_bytes, int max_ply) {
+
+   sint64 size, ply_size;
+
+   // entry count for a PGN input of that size, rounded up by table_init();
+   // a ply limit bounds it by the number of games, and an underestimate
+   // only costs a few table_grow() calls
+
+   size = pgn_bytes / TableBytesPerEntry;
+
+   ply_size = (pgn_bytes / TableBytesPerGame) * max_ply / TableRepeat;
+   if (size > ply_size) size = ply_size;
+
+   if (size < 1) size = 1;
+   if (size > TableInitMax) size = TableInitMax;
+
+   return int(size);
+}
+
+// table_advise()
+
+inline void table_advise(void * address, size_t size) {
+
+#ifdef MADV_HUGEPAGE
+
+   size_t start, end;
+
+   // ask for transparent huge pages over the aligned part, a hint only
+
+   if (!UseHugePage || size < size_t(TableHugePageSize)) return;
+
+   start = (size_t(address) + TableHugePageSize - 1) & ~size_t(TableHugePageSize - 1);
+   end = (size_t(address) + size) & ~size_t(TableHugePageSize - 1);
+
+   if (start < end) madvise((void *) start,end-start,MADV_HUGEPAGE);
+
+#endif
+}
+
+// table_link()
+
+template <class T> static void table_link(table_t<T> * table, uint64 slot) {
+
+   uint32 index;
+   uint32 dist;
+   uint64 other;
+
+   ASSERT(table!=NULL);
+   ASSERT(slot!=0);
+
+   // Robin Hood: take the place of any slot closer to its home
+
+   dist = 0;
+
+   for (index = uint32(slot >> 32) & table->mask; (other=table->slot[index]) != 0; index = (index+1) & table->mask) {
+
+      if (table_slot_dist(other,index,table->mask) < dist) {
+         table->slot[index] = slot;
+         slot = other;
+         dist = table_slot_dist(other,index,table->mask);
+      }
+
+      dist++;
+   }
+
+   table->slot[index] = slot;
+}
+
+// table_init()
+
+template <class T> static void table_init(table_t<T> * table, int hint = 1) {
+
+   size_t size;
+
+   ASSERT(table!=NULL);
+   ASSERT(hint>=0);
+
+   // allocate up front when the final size can be guessed, doubling
+   // later costs a realloc() plus a pass over the whole index
+
+   if (hint > TableAllocMax) hint = TableAllocMax;
+
+   table->alloc = 1;
+   while (table->alloc < hint) table->alloc *= 2;
+   table->mask = (table->alloc * 2) - 1;
+
+   table->size = 0;
+
+   size = 0;
+   size += table->alloc * sizeof(T);
+   size += (table->alloc*2) * sizeof(uint64);
+
+   if (size >= 1048576) fprintf(stderr,"allocating %gMB ...\n",double(size)/1048576.0);
+
+   table->entry = (T *) my_malloc(table->alloc*sizeof(T));
+   table_advise(table->entry,table->alloc*sizeof(T));
+
+   table->slot = (uint64 *) my_calloc((table->alloc*2)*sizeof(uint64));
+   table_advise(table->slot,(table->alloc*2)*sizeof(uint64));
+}
+
+// table_free()
+
+template <class T> static void table_free(table_t<T> * table) {
+
+   ASSERT(table!=NULL);
+
+   my_free(table->entry);
+   my_free(table->slot);
+
+   table->entry = NULL;
+   table->slot = NULL;
+}
+
+// table_grow()
+
+template <class T> static void table_grow(table_t<T> * table) {
+
+   uint64 * old;
+   int old_nb;
+   size_t size;
+   int index;
+
+   ASSERT(table!=NULL);
+   ASSERT(table->size==table->alloc);
+
+   if (table->alloc >= TableAllocMax) my_fatal("table_grow(): too many entries\n");
+
+   old = table->slot;
+   old_nb = table->alloc * 2;
+
+   table->alloc *= 2;
+   table->mask = (table->alloc * 2) - 1;
+
+   size = 0;
+   size += table->alloc * sizeof(T);
+   size += (table->alloc*2) * sizeof(uint64);
+
+   if (size >= 1048576) fprintf(stderr,"allocating %gMB ...\n",double(size)/1048576.0);
+
+   // resize arrays
+
+   table->entry = (T *) my_realloc(table->entry,table->alloc*sizeof(T));
+   table_advise(table->entry,table->alloc*sizeof(T));
+
+   table->slot = (uint64 *) my_calloc((table->alloc*2)*sizeof(uint64));
+   table_advise(table->slot,(table->alloc*2)*sizeof(uint64));
+
+   // move the slots over, the entries are not read
+
+   for (index = 0; index < old_nb; index++) {
+      if (old[index] != 0) table_link(table,old[index]);
+   }
+
+   my_free(old);
+}
+
+// table_rehash()
+
+template <class T> static void table_rehash(table_t<T> * table) {
+
+   int pos;
+
+   ASSERT(table!=NULL);
+   ASSERT(table->size<=table->alloc);
+
+   // rebuild the index after the entries were rewritten in place
+
+   memset(table->slot,0,(table->alloc*2)*sizeof(uint64));
+
+   for (pos = 0; pos < table->size; pos++) {
+      table_link(table,(uint64(uint32(table->entry[pos].key)) << 32) | uint32(pos+1));
+   }
+}
+
+// table_join()
+
+template <class T> static void table_join(table_t<T> * table, table_t<T> shard[], int shard_nb) {
+
+   int size;
+   int i;
+
+   ASSERT(table!=NULL);
+   ASSERT(shard!=NULL);
+   ASSERT(shard_nb>=1);
+
+   if (shard_nb == 1) {
+      *table = shard[0];
+      return;
+   }
+
+   // shards hold disjoint keys, concatenate them
+
+   size = 0;
+   for (i = 0; i < shard_nb; i++) size += shard[i].size;
+
+   table_init(table,size);
+
+   for (i = 0; i < shard_nb; i++) {
+
+      memcpy(&table->entry[table->size],shard[i].entry,shard[i].size*sizeof(T));
+      table->size += shard[i].size;
+
+      table_free(&shard[i]);
+   }
+
+   ASSERT(table->size==size);
+
+   table_rehash(table);
+}
+
+// table_find()
+
+template <class T> static int table_find(const table_t<T> * table, uint64 key, int move) {
+
+   uint32 tag;
+   uint32 index;
+   uint32 dist;
+   uint64 slot;
+   int pos;
+
+   ASSERT(table!=NULL);
+
+   tag = uint32(key);
+
+   dist = 0;
+
+   for (index = tag & table->mask; (slot=table->slot[index]) != 0; index = (index+1) & table->mask) {
+
+      if (table_slot_dist(slot,index,table->mask) < dist) break; // would have been placed here
+
+      if (uint32(slot >> 32) == tag) {
+
+         pos = table_slot_pos(slot);
+         ASSERT(pos>=0&&pos<table->size);
+
+         if (table->entry[pos].key == key && table->entry[pos].move == move) {
+            return pos; // found
+         }
+      }
+
+      dist++;
+   }
+
+   return TableNone;
+}
+
+// table_insert()
+
+template <class T> static int table_insert(table_t<T> * table, uint64 key, int move) {
+
+   int pos;
+
+   ASSERT(table!=NULL);
+   ASSERT(table_find(table,key,move)==TableNone);
+
+   ASSERT(table->size<=table->alloc);
+
+   if (table->size == table->alloc) table_grow(table);
+
+   // create a new zeroed entry
+
+   ASSERT(table->size<table->alloc);
+   pos = table->size++;
+
+   memset(&table->entry[pos],0,sizeof(T));
+   table->entry[pos].key = key;
+   table->entry[pos].move = move;
+
+   table_link(table,(uint64(uint32(key)) << 32) | uint32(pos+1));
+
+   return pos;
+}
+
+#endif // !defined TABLE_H
+
+// end of table.h
+
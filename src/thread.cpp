@@ -0,0 +1,217 @@
+
+// thread.cpp
+
+// includes
+
+#include <cerrno>
+#include <cstring>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "thread.h"
+#include "util.h"
+
+// prototypes
+
+static void * thread_main (void * arg);
+
+// functions
+
+// thread_nb_default()
+
+int thread_nb_default() {
+
+   long n;
+
+   n = sysconf(_SC_NPROCESSORS_ONLN);
+
+   if (n < 1) n = 1;
+   if (n > ThreadMax) n = ThreadMax;
+
+   return int(n);
+}
+
+// thread_start()
+
+void thread_start(thread_pool_t * pool, int thread_nb, thread_func_t func, void * data) {
+
+   int i;
+   int err;
+
+   ASSERT(pool!=NULL);
+   ASSERT(thread_nb>=1&&thread_nb<=ThreadMax);
+   ASSERT(func!=NULL);
+
+   if (thread_nb > ThreadMax) thread_nb = ThreadMax;
+
+   pool->size = thread_nb;
+   pool->func = func;
+   pool->data = data;
+
+   for (i = 0; i < thread_nb; i++) {
+
+      pool->arg[i].pool = pool;
+      pool->arg[i].id = i;
+
+      err = pthread_create(&pool->thread[i],NULL,thread_main,&pool->arg[i]);
+      if (err != 0) my_fatal("thread_start(): pthread_create(): %s\n",strerror(err));
+   }
+}
+
+// thread_join()
+
+void thread_join(thread_pool_t * pool) {
+
+   int i;
+   int err;
+
+   ASSERT(pool!=NULL);
+
+   for (i = 0; i < pool->size; i++) {
+      err = pthread_join(pool->thread[i],NULL);
+      if (err != 0) my_fatal("thread_join(): pthread_join(): %s\n",strerror(err));
+   }
+
+   pool->size = 0;
+}
+
+// thread_run()
+
+void thread_run(int thread_nb, thread_func_t func, void * data) {
+
+   thread_pool_t pool[1];
+
+   ASSERT(thread_nb>=1);
+   ASSERT(func!=NULL);
+
+   if (thread_nb == 1) { // no need for a thread
+      func(0,data);
+      return;
+   }
+
+   thread_start(pool,thread_nb,func,data);
+   thread_join(pool);
+}
+
+// thread_next()
+
+int thread_next(volatile int * counter) {
+
+   ASSERT(counter!=NULL);
+
+   return __sync_fetch_and_add(counter,1);
+}
+
+// thread_seq_init()
+
+void thread_seq_init(thread_seq_t * seq, int size, int window) {
+
+   int i;
+
+   ASSERT(seq!=NULL);
+   ASSERT(size>=0);
+   ASSERT(window>=0);
+
+   seq->size = size;
+   seq->window = window;
+   seq->drained = 0;
+
+   seq->done = (bool *) my_malloc((size+1)*sizeof(bool));
+   for (i = 0; i < size; i++) seq->done[i] = false;
+
+   pthread_mutex_init(seq->mutex,NULL);
+   pthread_cond_init(seq->cond,NULL);
+}
+
+// thread_seq_free()
+
+void thread_seq_free(thread_seq_t * seq) {
+
+   ASSERT(seq!=NULL);
+
+   pthread_cond_destroy(seq->cond);
+   pthread_mutex_destroy(seq->mutex);
+
+   my_free(seq->done);
+}
+
+// thread_seq_enter()
+
+void thread_seq_enter(thread_seq_t * seq, int index) {
+
+   ASSERT(seq!=NULL);
+   ASSERT(index>=0&&index<seq->size);
+
+   if (seq->window == 0) return;
+
+   // producers take indices in increasing order, so the consumer's next
+   // index is always in the window and this cannot deadlock
+
+   pthread_mutex_lock(seq->mutex);
+   while (index >= seq->drained + seq->window) pthread_cond_wait(seq->cond,seq->mutex);
+   pthread_mutex_unlock(seq->mutex);
+}
+
+// thread_seq_done()
+
+void thread_seq_done(thread_seq_t * seq, int index) {
+
+   ASSERT(seq!=NULL);
+   ASSERT(index>=0&&index<seq->size);
+
+   pthread_mutex_lock(seq->mutex);
+   seq->done[index] = true;
+   pthread_cond_broadcast(seq->cond);
+   pthread_mutex_unlock(seq->mutex);
+}
+
+// thread_seq_wait()
+
+void thread_seq_wait(thread_seq_t * seq, int index) {
+
+   ASSERT(seq!=NULL);
+   ASSERT(index>=0&&index<seq->size);
+
+   pthread_mutex_lock(seq->mutex);
+   while (!seq->done[index]) pthread_cond_wait(seq->cond,seq->mutex);
+   pthread_mutex_unlock(seq->mutex);
+}
+
+// thread_seq_leave()
+
+void thread_seq_leave(thread_seq_t * seq, int index) {
+
+   ASSERT(seq!=NULL);
+
+   if (seq->window == 0) return;
+
+   ASSERT(index==seq->drained);
+
+   pthread_mutex_lock(seq->mutex);
+   seq->drained = index + 1;
+   pthread_cond_broadcast(seq->cond);
+   pthread_mutex_unlock(seq->mutex);
+}
+
+// thread_main()
+
+static void * thread_main(void * arg) {
+
+   thread_arg_t * thread_arg;
+   thread_pool_t * pool;
+
+   ASSERT(arg!=NULL);
+
+   thread_arg = (thread_arg_t *) arg;
+   pool = thread_arg->pool;
+
+   ASSERT(thread_arg->id>=0&&thread_arg->id<pool->size);
+
+   pool->func(thread_arg->id,pool->data);
+
+   return NULL;
+}
+
+// end of thread.cpp
+
@@ -0,0 +1,65 @@
+
+// thread.h
+
+#ifndef THREAD_H
+#define THREAD_H
+
+// includes
+
+#include <pthread.h>
+
+#include "util.h"
+
+// constants
+
+const int ThreadMax = 256;
+
+// types
+
+typedef void (*thread_func_t) (int id, void * data);
+
+struct thread_pool_t;
+
+struct thread_arg_t {
+   thread_pool_t * pool;
+   int id;
+};
+
+struct thread_pool_t {
+   int size;
+   thread_func_t func;
+   void * data;
+   pthread_t thread[ThreadMax];
+   thread_arg_t arg[ThreadMax];
+};
+
+struct thread_seq_t {
+   int size;
+   int window; // indices in flight, 0 = no limit
+   int drained; // indices released by the consumer, in order
+   bool * done;
+   pthread_mutex_t mutex[1];
+   pthread_cond_t cond[1];
+};
+
+// functions
+
+extern int  thread_nb_default ();
+
+extern void thread_start      (thread_pool_t * pool, int thread_nb, thread_func_t func, void * data);
+extern void thread_join       (thread_pool_t * pool);
+extern void thread_run        (int thread_nb, thread_func_t func, void * data);
+
+extern int  thread_next       (volatile int * counter);
+
+extern void thread_seq_init   (thread_seq_t * seq, int size, int window);
+extern void thread_seq_free   (thread_seq_t * seq);
+extern void thread_seq_enter  (thread_seq_t * seq, int index);
+extern void thread_seq_done   (thread_seq_t * seq, int index);
+extern void thread_seq_wait   (thread_seq_t * seq, int index);
+extern void thread_seq_leave  (thread_seq_t * seq, int index);
+
+#endif // !defined THREAD_H
+
+// end of thread.h
+
@@ -12,6 +12,8 @@
 #include <cstring>
 #include <ctime>
 
+#include <sys/stat.h>
+
 #include "main.h"
 #include "posix.h"
 #include "util.h"
@@ -93,7 +95,7 @@ int my_round(double x) {
 
 // my_malloc()
 
-void * my_malloc(int size) {
+void * my_malloc(size_t size) {
 
    void * address;
 
@@ -105,15 +107,31 @@ void * my_malloc(int size) {
    return address;
 }
 
+// my_calloc()
+
+void * my_calloc(size_t size) {
+
+   void * address;
+
+   ASSERT(size>0);
+
+   // large blocks come from fresh zero pages, committed when first touched
+
+   address = calloc(size,1);
+   if (address == NULL) my_fatal("my_calloc(): calloc(): %s\n",strerror(errno));
+
+   return address;
+}
+
 // my_realloc()
 
-void * my_realloc(void * address, int size) {
+void * my_realloc(void * address, size_t size) {
 
    ASSERT(address!=NULL);
    ASSERT(size>0);
 
    if (size > 1000000) {
-     fprintf(stderr, "my_realloc(%i)\n", size);
+     fprintf(stderr, "my_realloc(%.0f)\n", double(size));
    }
 
    address = realloc(address,size);
@@ -222,6 +240,20 @@ bool my_file_read_line(FILE * file, char string[], int size) {
    return true;
 }
 
+// my_file_size()
+
+sint64 my_file_size(const char file_name[]) {
+
+   struct stat buf[1];
+
+   ASSERT(file_name!=NULL);
+
+   if (stat(file_name,buf) == -1) return -1;
+   if (!S_ISREG(buf->st_mode)) return -1; // directory, pipe ...
+
+   return buf->st_size;
+}
+
 // my_string_empty()
 
 bool my_string_empty(const char string[]) {
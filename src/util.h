@@ -87,8 +87,9 @@ extern sint64 my_atoll              (const char string[]);
 
 extern int    my_round              (double x);
 
-extern void * my_malloc             (int size);
-extern void * my_realloc            (void * address, int size);
+extern void * my_malloc             (size_t size);
+extern void * my_calloc             (size_t size);
+extern void * my_realloc            (void * address, size_t size);
 extern void   my_free               (void * address);
 
 extern void   my_log_open           (const char file_name[]);
@@ -98,6 +99,7 @@ extern void   my_log                (const char format[], ...);
 extern void   my_fatal              (const char format[], ...);
 
 extern bool   my_file_read_line     (FILE * file, char string[], int size);
+extern sint64 my_file_size          (const char file_name[]);
 
 extern bool   my_string_empty       (const char string[]);
 extern bool   my_string_equal       (const char string_1[], const char string_2[]);